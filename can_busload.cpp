@@ -0,0 +1,290 @@
+#include <Arduino.h>
+#include "can_busload.h"
+
+// Bits after the CRC that are never stuffed: CRC delimiter, ACK slot, ACK
+// delimiter, end of frame and the intermission before the next frame.
+#define CAN_FRAME_TRAILER_BITS 13
+#define CAN_CRC15_POLY 0x4599
+
+typedef struct {
+	uint16_t crc;
+	uint8_t bits;
+	uint8_t stuffed;
+	uint8_t run;
+	uint8_t last;
+} CANBitStream;
+
+// Feeds the n low bits of value, MSB first, through the CRC and the
+// stuffing rule: after five equal bits the transmitter inserts one of the
+// opposite level, which itself counts towards the next run.
+static void emitBits(CANBitStream *s, uint32_t value, uint8_t n, bool crc) {
+	while(n--) {
+		uint8_t bit = (value >> n) & 1;
+		if(crc) {
+			uint8_t next = bit ^ ((s->crc >> 14) & 1);
+			s->crc = (s->crc << 1) & 0x7FFF;
+			if(next)
+				s->crc ^= CAN_CRC15_POLY;
+		}
+		s->bits++;
+		if(bit == s->last) {
+			if(++s->run == 5) {
+				s->stuffed++;
+				s->last = !bit;
+				s->run = 1;
+			}
+		} else {
+			s->last = bit;
+			s->run = 1;
+		}
+	}
+}
+
+// Exact length on the wire, including stuff bits and interframe space
+uint8_t CANBusLoad::frameBits(INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *data) {
+	CANBitStream s = {0, 0, 0, 0, 2};
+	uint8_t dlc = len & 0x0F;
+
+	len = (rtr || data == NULL) ? 0 : (dlc > 8 ? 8 : dlc);
+	emitBits(&s, 0, 1, true);                       // SOF
+	if(ext) {
+		emitBits(&s, id >> 18, 11, true);
+		emitBits(&s, 3, 2, true);                   // SRR, IDE
+		emitBits(&s, id & 0x3FFFF, 18, true);
+		emitBits(&s, rtr ? 1 : 0, 1, true);
+		emitBits(&s, 0, 2, true);                   // r1, r0
+	} else {
+		emitBits(&s, id & 0x7FF, 11, true);
+		emitBits(&s, rtr ? 1 : 0, 1, true);
+		emitBits(&s, 0, 2, true);                   // IDE, r0
+	}
+	emitBits(&s, dlc, 4, true);
+	for(uint8_t i = 0; i < len; i++)
+		emitBits(&s, data[i], 8, true);
+	emitBits(&s, s.crc, 15, false);
+	return s.bits + s.stuffed + CAN_FRAME_TRAILER_BITS;
+}
+
+// Upper bound over all IDs and payloads of the given shape
+uint8_t CANBusLoad::worstFrameBits(INT8U ext, INT8U rtr, INT8U len) {
+	uint8_t stuffable = (ext ? 54 : 34) + (rtr ? 0 : 8 * (len > 8 ? 8 : len));
+	return stuffable + (stuffable - 1) / 4 + CAN_FRAME_TRAILER_BITS;
+}
+
+CANBusLoad::CANBusLoad(MCP_CAN *can) {
+	this->can = can;
+	this->entries = NULL;
+	this->max_entries = 0;
+	this->n_entries = 0;
+	this->bitrate = 0;
+	this->bucket_ms = 1;
+}
+
+// Starts accounting every frame read or sent through the driver. bitrate is
+// in bits per second; the window is CAN_BUSLOAD_BUCKETS * bucket_ms long.
+// Other frame hooks keep running; returns false if the driver has no room
+// for another.
+bool CANBusLoad::begin(uint32_t bitrate, uint16_t bucket_ms, CANLoadEntry *entries, uint8_t n_entries) {
+	this->bitrate = bitrate;
+	this->bucket_ms = bucket_ms ? bucket_ms : 1;
+	this->entries = entries;
+	this->max_entries = n_entries;
+	this->n_entries = 0;
+	this->bucket = 0;
+	this->started = this->bucket_start = millis();
+	for(uint8_t b = 0; b < CAN_BUSLOAD_BUCKETS; b++) {
+		this->frames[b] = 0;
+		this->bits[b] = 0;
+		this->worst_bits[b] = 0;
+	}
+	return this->can->addFrameHook(CANBusLoad::frameHook, this) == CAN_OK;
+}
+
+void CANBusLoad::end() {
+	this->can->removeFrameHook(CANBusLoad::frameHook, this);
+}
+
+void CANBusLoad::frameHook(void *context, INT8U dir, INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *buf) {
+	((CANBusLoad *)context)->record(id, ext, rtr, len, buf);
+}
+
+// Entries are kept sorted by ID so the table prints in priority order
+CANLoadEntry *CANBusLoad::findEntry(INT32U id, INT8U ext) {
+	uint32_t key = id | ((uint32_t)(ext ? 1 : 0) << 31);
+	uint8_t lo = 0, hi = this->n_entries;
+	while(lo < hi) {
+		uint8_t mid = (lo + hi) / 2;
+		uint32_t mid_key = this->entries[mid].id | ((uint32_t)this->entries[mid].ext << 31);
+		if(mid_key == key)
+			return &this->entries[mid];
+		if(mid_key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if(this->n_entries == this->max_entries)
+		return NULL;
+
+	memmove(&this->entries[lo + 1], &this->entries[lo], (this->n_entries - lo) * sizeof(CANLoadEntry));
+	this->n_entries++;
+	CANLoadEntry *entry = &this->entries[lo];
+	memset(entry, 0, sizeof(CANLoadEntry));
+	entry->id = id;
+	entry->ext = ext ? 1 : 0;
+	return entry;
+}
+
+void CANBusLoad::advance(uint32_t now) {
+	uint32_t elapsed = (now - this->bucket_start) / this->bucket_ms;
+	if(elapsed == 0)
+		return;
+
+	this->bucket_start += elapsed * this->bucket_ms;
+	if(elapsed > CAN_BUSLOAD_BUCKETS)
+		elapsed = CAN_BUSLOAD_BUCKETS;
+	while(elapsed--) {
+		this->bucket = (this->bucket + 1) % CAN_BUSLOAD_BUCKETS;
+		this->frames[this->bucket] = 0;
+		this->bits[this->bucket] = 0;
+		this->worst_bits[this->bucket] = 0;
+		for(uint8_t i = 0; i < this->n_entries; i++) {
+			this->entries[i].frames[this->bucket] = 0;
+			this->entries[i].bits[this->bucket] = 0;
+		}
+	}
+}
+
+// Accounts one frame. Called from the driver hook; call it directly for
+// traffic that does not pass through this controller.
+void CANBusLoad::record(INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *data) {
+	uint8_t bits = CANBusLoad::frameBits(id, ext, rtr, len, data);
+	uint8_t worst = CANBusLoad::worstFrameBits(ext, rtr, len & 0x0F);
+
+	this->advance(millis());
+	this->frames[this->bucket]++;
+	this->bits[this->bucket] += bits;
+	this->worst_bits[this->bucket] += worst;
+
+	CANLoadEntry *entry = this->findEntry(id, ext);
+	if(entry == NULL)
+		return;
+	entry->frames[this->bucket]++;
+	entry->bits[this->bucket] += bits;
+	if(worst > entry->worst_bits)
+		entry->worst_bits = worst;
+}
+
+// Bits the bus could have carried over the part of the window that has elapsed
+uint32_t CANBusLoad::capacity(uint32_t now) {
+	uint32_t window = (uint32_t)(CAN_BUSLOAD_BUCKETS - 1) * this->bucket_ms + (now - this->bucket_start);
+	if(now - this->started < window)
+		window = now - this->started;
+	return (this->bitrate / 1000) * (window ? window : 1);
+}
+
+uint16_t CANBusLoad::permille(uint32_t bits, uint32_t capacity) {
+	return (uint16_t)(((uint64_t)bits * 1000) / capacity);
+}
+
+uint16_t CANBusLoad::load() {
+	uint32_t now = millis(), bits = 0;
+	this->advance(now);
+	for(uint8_t b = 0; b < CAN_BUSLOAD_BUCKETS; b++)
+		bits += this->bits[b];
+	return this->permille(bits, this->capacity(now));
+}
+
+uint16_t CANBusLoad::worstLoad() {
+	uint32_t now = millis(), bits = 0;
+	this->advance(now);
+	for(uint8_t b = 0; b < CAN_BUSLOAD_BUCKETS; b++)
+		bits += this->worst_bits[b];
+	return this->permille(bits, this->capacity(now));
+}
+
+// An ID's worst case assumes every frame in the window was as long as its
+// longest, fully stuffed.
+void CANBusLoad::fillRow(CANLoadEntry *entry, uint32_t capacity, CANLoadReport *row) {
+	uint32_t frames = 0, bits = 0;
+	for(uint8_t b = 0; b < CAN_BUSLOAD_BUCKETS; b++) {
+		frames += entry->frames[b];
+		bits += entry->bits[b];
+	}
+	row->id = entry->id;
+	row->ext = entry->ext;
+	row->frames = frames > 0xFFFF ? 0xFFFF : frames;
+	row->load = this->permille(bits, capacity);
+	row->worst_load = this->permille(frames * entry->worst_bits, capacity);
+}
+
+// Fills rows with the tracked IDs in ID order and returns how many were written
+uint8_t CANBusLoad::report(CANLoadReport *rows, uint8_t max_rows) {
+	uint32_t now = millis();
+	this->advance(now);
+	uint32_t capacity = this->capacity(now);
+
+	uint8_t n;
+	for(n = 0; n < this->n_entries && n < max_rows; n++)
+		this->fillRow(&this->entries[n], capacity, &rows[n]);
+	return n;
+}
+
+void CANBusLoad::printCount(Print &out, uint32_t count) {
+	for(uint32_t width = 100000; width > 1 && count < width; width /= 10)
+		out.print(' ');
+	out.print((unsigned long)count);
+}
+
+void CANBusLoad::printLoad(Print &out, uint16_t load) {
+	out.print("  ");
+	if(load < 1000)
+		out.print(' ');
+	if(load < 100)
+		out.print(' ');
+	out.print(load / 10);
+	out.print('.');
+	out.print(load % 10);
+}
+
+// One line per tracked ID, then traffic from untracked IDs and the total:
+//   ID      frames   load  worst
+//   123         40   12.3   14.0
+void CANBusLoad::printTable(Print &out) {
+	static const char hex[] = "0123456789ABCDEF";
+	uint32_t now = millis();
+	this->advance(now);
+	uint32_t capacity = this->capacity(now);
+
+	uint32_t tracked_frames = 0, tracked_load = 0;
+	out.println("ID      frames   load  worst");
+	for(uint8_t i = 0; i < this->n_entries; i++) {
+		CANLoadReport row;
+		this->fillRow(&this->entries[i], capacity, &row);
+
+		uint8_t digits = row.ext ? 8 : 3;
+		for(uint8_t d = 0; d < 8; d++)
+			out.print(d < digits ? hex[(row.id >> (4 * (digits - 1 - d))) & 0xF] : ' ');
+		this->printCount(out, row.frames);
+		this->printLoad(out, row.load);
+		this->printLoad(out, row.worst_load);
+		out.println();
+		tracked_frames += row.frames;
+		tracked_load += row.load;
+	}
+
+	uint32_t frames = 0;
+	for(uint8_t b = 0; b < CAN_BUSLOAD_BUCKETS; b++)
+		frames += this->frames[b];
+	uint16_t total = this->load();
+	if(frames > tracked_frames) {
+		out.print("other   ");
+		this->printCount(out, frames - tracked_frames);
+		this->printLoad(out, total > tracked_load ? total - tracked_load : 0);
+		out.println();
+	}
+	out.print("total   ");
+	this->printCount(out, frames);
+	this->printLoad(out, total);
+	this->printLoad(out, this->worstLoad());
+	out.println();
+}
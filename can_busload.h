@@ -0,0 +1,89 @@
+/*
+  can_busload.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _CAN_BUSLOAD_H_
+#define _CAN_BUSLOAD_H_
+
+#include <Arduino.h>
+#include "mcp_can.h"
+
+// Number of buckets in the sliding window; the window is this many bucket
+// periods long and slides one bucket at a time.
+#ifndef CAN_BUSLOAD_BUCKETS
+#define CAN_BUSLOAD_BUCKETS 4
+#endif
+
+// Accounting for one CAN ID. The application owns the storage and hands an
+// array of these to CANBusLoad::begin; IDs are tracked first come, first served.
+typedef struct CANLoadEntry {
+  INT32U id;
+  INT8U ext;
+  INT8U worst_bits;                 // longest worst case stuffed frame seen
+  uint16_t frames[CAN_BUSLOAD_BUCKETS];
+  uint32_t bits[CAN_BUSLOAD_BUCKETS];
+} CANLoadEntry;
+
+// Utilisation of the window, in tenths of a percent of the bus capacity
+typedef struct {
+  INT32U id;
+  INT8U ext;
+  uint16_t frames;
+  uint16_t load;                    // actual on-wire bits
+  uint16_t worst_load;              // every frame stuffed as badly as possible
+} CANLoadReport;
+
+class CANBusLoad {
+private:
+    MCP_CAN *can;
+    CANLoadEntry *entries;
+    uint8_t max_entries;
+    uint8_t n_entries;
+    uint32_t bitrate;
+    uint16_t bucket_ms;
+    uint8_t bucket;
+    uint32_t bucket_start;
+    uint32_t started;
+    uint16_t frames[CAN_BUSLOAD_BUCKETS];
+    uint32_t bits[CAN_BUSLOAD_BUCKETS];
+    uint32_t worst_bits[CAN_BUSLOAD_BUCKETS];
+
+    static void frameHook(void *context, INT8U dir, INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *buf);
+    CANLoadEntry *findEntry(INT32U id, INT8U ext);
+    void advance(uint32_t now);
+    uint32_t capacity(uint32_t now);
+    uint16_t permille(uint32_t bits, uint32_t capacity);
+    void fillRow(CANLoadEntry *entry, uint32_t capacity, CANLoadReport *row);
+    void printCount(Print &out, uint32_t count);
+    void printLoad(Print &out, uint16_t load);
+
+public:
+    CANBusLoad(MCP_CAN *can);
+    bool begin(uint32_t bitrate, uint16_t bucket_ms, CANLoadEntry *entries, uint8_t n_entries);
+    void end();
+    void record(INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *data);
+    uint16_t load();
+    uint16_t worstLoad();
+    uint8_t report(CANLoadReport *rows, uint8_t max_rows);
+    void printTable(Print &out);
+
+    static uint8_t frameBits(INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *data);
+    static uint8_t worstFrameBits(INT8U ext, INT8U rtr, INT8U len);
+};
+
+#endif
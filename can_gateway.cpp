@@ -0,0 +1,147 @@
+#include <Arduino.h>
+#include "can_gateway.h"
+
+// The controller has two receive buffers
+#define CAN_GATEWAY_RX_BUFFERS 2
+
+CANGateway::CANGateway(MCP_CAN *can0, MCP_CAN *can1, CANFramePool *pool)
+	: tx0(pool, CAN_GATEWAY_QUEUE_DEPTH), tx1(pool, CAN_GATEWAY_QUEUE_DEPTH) {
+	this->can[0] = can0;
+	this->can[1] = can1;
+	this->pool = pool;
+	this->queued_head[0] = 0;
+	this->queued_head[1] = 0;
+	this->routes = NULL;
+	this->n_routes = 0;
+	this->resetStatistics();
+}
+
+// Both controllers must already be running. Give each an interrupt pin with
+// setIntPin() so that service() only touches SPI when a frame is waiting.
+void CANGateway::begin(CANRoute *routes, uint8_t n_routes) {
+	this->routes = routes;
+	this->n_routes = n_routes;
+	for(uint8_t i = 0; i < CAN_GATEWAY_CHANNELS; i++) {
+		// Frames with the same ID must leave in the order they arrived
+		this->can[i]->setOrderedTx(1);
+		// Frames queued under an old table are no route's in this one
+		this->queued_head[i] = 0;
+		memset(this->queued_route[i], CAN_GATEWAY_NO_ROUTE, sizeof(this->queued_route[i]));
+	}
+	this->resetStatistics();
+}
+
+void CANGateway::resetStatistics() {
+	for(uint8_t i = 0; i < CAN_GATEWAY_CHANNELS; i++) {
+		this->stats[i].received = 0;
+		this->stats[i].unrouted = 0;
+		this->stats[i].latency_max = 0;
+	}
+	for(uint8_t i = 0; i < this->n_routes; i++) {
+		this->routes[i].forwarded = 0;
+		this->routes[i].dropped = 0;
+	}
+}
+
+CANGatewayStats *CANGateway::getStats(uint8_t channel) {
+	return &this->stats[channel];
+}
+
+uint8_t CANGateway::getQueueHighWater(uint8_t channel) {
+	return this->queue(channel)->highWater();
+}
+
+CANFrameQueue *CANGateway::queue(uint8_t channel) {
+	return channel ? &this->tx1 : &this->tx0;
+}
+
+// Binary search over the non-overlapping ranges, ordered by (from, ext, first)
+CANRoute *CANGateway::findRoute(uint8_t from, INT8U ext, INT32U id) {
+	uint8_t lo = 0, hi = this->n_routes;
+	while(lo < hi) {
+		uint8_t mid = (lo + hi) / 2;
+		CANRoute *route = &this->routes[mid];
+		if(from < route->from || (from == route->from && (ext < route->ext || (ext == route->ext && id < route->first))))
+			hi = mid;
+		else if(from > route->from || ext > route->ext || id > route->last)
+			lo = mid + 1;
+		else
+			return route;
+	}
+	return NULL;
+}
+
+// Moves what the controller's receive buffers held into the other channel's
+// queue. Reads no more frames than there are buffers, so a flood on one
+// channel can't keep service() from loading the other's transmit buffers.
+void CANGateway::receive(uint8_t channel) {
+	MCP_CAN *can = this->can[channel];
+	CANFrameQueue *out = this->queue(!channel);
+
+	for(uint8_t read = 0; read < CAN_GATEWAY_RX_BUFFERS && can->checkReceive() == CAN_MSGAVAIL; read++) {
+		INT8U len, data[MAX_CHAR_IN_MESSAGE];
+		can->readMsgBuf(&len, data);
+		this->stats[channel].received++;
+
+		INT32U id = can->getCanId();
+		INT8U ext = can->isExtendedFrame();
+		CANRoute *route = this->findRoute(channel, ext, id);
+		if(route == NULL) {
+			this->stats[channel].unrouted++;
+			continue;
+		}
+
+		CANFrame *frame = this->pool->allocate();
+		if(frame == NULL) {
+			route->dropped++;
+			continue;
+		}
+		frame->id = (id & ~route->rewrite_mask) | (route->rewrite_value & route->rewrite_mask);
+		frame->id &= ext ? 0x1FFFFFFFUL : 0x7FFUL;
+		frame->ext = ext;
+		frame->rtr = can->isRemoteRequest();
+		frame->len = len;
+		memcpy(frame->data, data, len);
+		frame->stamp = micros();
+		if(out->push(frame)) {
+			uint8_t tail = (this->queued_head[!channel] + out->size() - 1) % CAN_GATEWAY_QUEUE_DEPTH;
+			this->queued_route[!channel][tail] = route - this->routes;
+		} else {
+			this->pool->release(frame);
+			route->dropped++;
+		}
+	}
+}
+
+// Loads queued frames into free transmit buffers without waiting
+void CANGateway::transmit(uint8_t channel) {
+	MCP_CAN *can = this->can[channel];
+	CANFrameQueue *out = this->queue(channel);
+	CANFrame *frame;
+
+	while((frame = out->peek()) != NULL) {
+		INT8U res = frame->rtr
+			? can->trySendRemoteRequest(frame->id, frame->ext, frame->len)
+			: can->trySendMsgBuf(frame->id, frame->ext, frame->len, frame->data);
+		if(res != CAN_OK)
+			return;
+		uint32_t latency = micros() - frame->stamp;
+		if(latency > this->stats[channel].latency_max)
+			this->stats[channel].latency_max = latency;
+		uint8_t route = this->queued_route[channel][this->queued_head[channel]];
+		if(route < this->n_routes)
+			this->routes[route].forwarded++;
+		this->queued_head[channel] = (this->queued_head[channel] + 1) % CAN_GATEWAY_QUEUE_DEPTH;
+		this->pool->release(out->pop());
+	}
+}
+
+// Moves frames across in both directions. Call as often as possible; each
+// frame is handed to the output controller in the same call it was read, as
+// long as that controller has a buffer free.
+void CANGateway::service() {
+	for(uint8_t i = 0; i < CAN_GATEWAY_CHANNELS; i++) {
+		this->receive(i);
+		this->transmit(!i);
+	}
+}
@@ -0,0 +1,86 @@
+/*
+  can_gateway.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _CAN_GATEWAY_H_
+#define _CAN_GATEWAY_H_
+
+#include "mcp_can.h"
+#include "can_pool.h"
+
+// Frames waiting for a transmit buffer on each output channel, borrowed from
+// the gateway's frame pool
+#ifndef CAN_GATEWAY_QUEUE_DEPTH
+#define CAN_GATEWAY_QUEUE_DEPTH 8
+#endif
+#define CAN_GATEWAY_CHANNELS 2
+#define CAN_GATEWAY_NO_ROUTE 0xFF
+
+// Forwards frames of one format with IDs first..last (inclusive) arriving on
+// channel from to the other channel. The ID bits selected by rewrite_mask are
+// replaced with those of rewrite_value; a zero mask forwards the ID unchanged.
+// Rewritten IDs are cut to 11 bits for standard frames and 29 for extended.
+// Tables passed to CANGateway::begin must be sorted by from, then ext, then
+// first, with non-overlapping ranges.
+typedef struct {
+  INT8U from;
+  INT8U ext;
+  INT32U first;
+  INT32U last;
+  INT32U rewrite_mask;
+  INT32U rewrite_value;
+
+  // Maintained by the gateway
+  uint32_t forwarded;               // loaded into the output controller
+  uint32_t dropped;                 // output queue or frame pool full
+} CANRoute;
+
+typedef struct {
+  uint32_t received;
+  uint32_t unrouted;                // no route
+  uint32_t latency_max;             // us from reading a frame to loading it for output here
+} CANGatewayStats;
+
+class CANGateway {
+private:
+    MCP_CAN *can[CAN_GATEWAY_CHANNELS];
+    CANFramePool *pool;
+    CANFrameQueue tx0;
+    CANFrameQueue tx1;
+    // Route of each queued frame, in queue order, for counting it once it leaves
+    uint8_t queued_route[CAN_GATEWAY_CHANNELS][CAN_GATEWAY_QUEUE_DEPTH];
+    uint8_t queued_head[CAN_GATEWAY_CHANNELS];
+    CANRoute *routes;
+    uint8_t n_routes;
+    CANGatewayStats stats[CAN_GATEWAY_CHANNELS];
+
+    CANFrameQueue *queue(uint8_t channel);
+    CANRoute *findRoute(uint8_t from, INT8U ext, INT32U id);
+    void receive(uint8_t channel);
+    void transmit(uint8_t channel);
+
+public:
+    CANGateway(MCP_CAN *can0, MCP_CAN *can1, CANFramePool *pool = &CANPool);
+    void begin(CANRoute *routes, uint8_t n_routes);
+    void service();
+    CANGatewayStats *getStats(uint8_t channel);
+    uint8_t getQueueHighWater(uint8_t channel);
+    void resetStatistics();
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include <Arduino.h>
+#include "can_isotp.h"
+
+// Protocol control information: the high nibble of the first byte
+#define CAN_ISOTP_SINGLE 0x00
+#define CAN_ISOTP_FIRST 0x10
+#define CAN_ISOTP_CONSECUTIVE 0x20
+#define CAN_ISOTP_FLOW 0x30
+
+#define CAN_ISOTP_FLOW_CTS 0
+#define CAN_ISOTP_FLOW_WAIT 1
+#define CAN_ISOTP_FLOW_OVERFLOW 2
+#define CAN_ISOTP_NO_FLOW -1
+
+CANIsoTP::CANIsoTP(MCP_CAN *can, INT32U tx_id, INT32U rx_id, INT8U ext) {
+	this->can = can;
+	this->tx_id = tx_id;
+	this->rx_id = rx_id;
+	this->ext = ext;
+	memset(&this->stats, 0, sizeof(this->stats));
+	this->tx_status = CAN_ISOTP_DONE;
+	this->tx_waiting = false;
+	this->rx_buffer = NULL;
+	this->rx_size = 0;
+	this->rx_block_size = 0;
+	this->rx_st_min = 0;
+	this->rx_complete = 0;
+	this->rx_active = false;
+	this->rx_flow = CAN_ISOTP_NO_FLOW;
+}
+
+// Sets the reassembly buffer, and the block size and separation time
+// (encoded as in flow control frames) the peer is asked to keep to when
+// sending to us. Abandons any transfer in progress.
+void CANIsoTP::begin(uint8_t *rx_buffer, uint16_t rx_size, uint8_t block_size, uint8_t st_min) {
+	memset(&this->stats, 0, sizeof(this->stats));
+	this->tx_status = CAN_ISOTP_DONE;
+	this->tx_waiting = false;
+	this->rx_buffer = rx_buffer;
+	this->rx_size = rx_size;
+	this->rx_block_size = block_size;
+	this->rx_st_min = st_min;
+	this->rx_complete = 0;
+	this->rx_active = false;
+	this->rx_flow = CAN_ISOTP_NO_FLOW;
+	this->can->setOrderedTx(1);
+}
+
+bool CANIsoTP::sendFrame(const uint8_t *data, uint8_t len) {
+	INT8U frame[MAX_CHAR_IN_MESSAGE];
+	memcpy(frame, data, len);
+	memset(frame + len, CAN_ISOTP_PADDING, MAX_CHAR_IN_MESSAGE - len);
+	return this->can->trySendMsgBuf(this->tx_id, this->ext, MAX_CHAR_IN_MESSAGE, frame) == CAN_OK;
+}
+
+// Starts sending len bytes from data, which must stay untouched until
+// getTxStatus() is no longer CAN_ISOTP_BUSY. Returns false if a message is
+// still being sent or len is out of range.
+bool CANIsoTP::send(const uint8_t *data, uint16_t len) {
+	if(this->tx_status == CAN_ISOTP_BUSY || len == 0 || len > CAN_ISOTP_MAX_LENGTH)
+		return false;
+	this->tx_data = data;
+	this->tx_len = len;
+	this->tx_offset = 0;
+	this->tx_waiting = false;
+	this->tx_status = CAN_ISOTP_BUSY;
+	this->transmit();
+	return true;
+}
+
+uint8_t CANIsoTP::getTxStatus() {
+	return this->tx_status;
+}
+
+// Loads as many frames of the message being sent as there are free
+// transmit buffers, within the peer's block size and separation time.
+void CANIsoTP::transmit() {
+	uint8_t frame[MAX_CHAR_IN_MESSAGE];
+	uint16_t n;
+
+	if(this->tx_status != CAN_ISOTP_BUSY || this->tx_waiting)
+		return;
+
+	if(this->tx_offset == 0) {
+		if(this->tx_len < MAX_CHAR_IN_MESSAGE) {
+			frame[0] = CAN_ISOTP_SINGLE | this->tx_len;
+			memcpy(frame + 1, this->tx_data, this->tx_len);
+			if(!this->sendFrame(frame, this->tx_len + 1))
+				return;
+			this->tx_status = CAN_ISOTP_DONE;
+			this->stats.sent++;
+			return;
+		}
+		frame[0] = CAN_ISOTP_FIRST | (this->tx_len >> 8);
+		frame[1] = this->tx_len;
+		memcpy(frame + 2, this->tx_data, 6);
+		if(!this->sendFrame(frame, MAX_CHAR_IN_MESSAGE))
+			return;
+		this->tx_offset = 6;
+		this->tx_seq = 1;
+		this->tx_waiting = true;
+		this->tx_waits = 0;
+		this->tx_wait_start = millis();
+		return;
+	}
+
+	while(this->tx_offset < this->tx_len) {
+		if(this->tx_st_min > 0 && (uint32_t)(micros() - this->tx_last) < this->tx_st_min)
+			return;
+		n = this->tx_len - this->tx_offset;
+		if(n > 7)
+			n = 7;
+		frame[0] = CAN_ISOTP_CONSECUTIVE | this->tx_seq;
+		memcpy(frame + 1, this->tx_data + this->tx_offset, n);
+		if(!this->sendFrame(frame, n + 1))
+			return;
+		this->tx_last = micros();
+		this->tx_seq = (this->tx_seq + 1) & 0x0F;
+		this->tx_offset += n;
+		if(this->tx_block_size > 0 && --this->tx_block_left == 0 && this->tx_offset < this->tx_len) {
+			this->tx_waiting = true;
+			this->tx_wait_start = millis();
+			return;
+		}
+	}
+	this->tx_status = CAN_ISOTP_DONE;
+	this->stats.sent++;
+}
+
+void CANIsoTP::receiveFlowControl(INT8U len, const INT8U *data) {
+	if(this->tx_status != CAN_ISOTP_BUSY || !this->tx_waiting || len < 3)
+		return;
+
+	switch(data[0] & 0x0F) {
+	case CAN_ISOTP_FLOW_CTS:
+		this->tx_block_size = data[1];
+		this->tx_block_left = data[1];
+		// 0-127 ms, or 100-900 us; reserved values mean the longest
+		if(data[2] <= 0x7F)
+			this->tx_st_min = data[2] * 1000UL;
+		else if(data[2] >= 0xF1 && data[2] <= 0xF9)
+			this->tx_st_min = (data[2] - 0xF0) * 100UL;
+		else
+			this->tx_st_min = 127000UL;
+		this->tx_last = micros() - this->tx_st_min;
+		this->tx_waiting = false;
+		break;
+	case CAN_ISOTP_FLOW_WAIT:
+		if(++this->tx_waits > CAN_ISOTP_MAX_WAITS)
+			this->tx_status = CAN_ISOTP_TIMEOUT;
+		this->tx_wait_start = millis();
+		break;
+	case CAN_ISOTP_FLOW_OVERFLOW:
+		this->tx_status = CAN_ISOTP_OVERFLOW;
+		break;
+	}
+}
+
+void CANIsoTP::sendFlowControl() {
+	if(this->rx_flow == CAN_ISOTP_NO_FLOW)
+		return;
+	uint8_t frame[3] = {(uint8_t)(CAN_ISOTP_FLOW | this->rx_flow), this->rx_block_size, this->rx_st_min};
+	if(this->sendFrame(frame, sizeof(frame)))
+		this->rx_flow = CAN_ISOTP_NO_FLOW;
+}
+
+// Handles a frame read from the controller. Returns false if it doesn't
+// belong to this connection. Only changes state: flow control and the
+// frames it releases go out from service(), since this may run inside the
+// controller's readMsg, which sending would clobber.
+bool CANIsoTP::receive(INT32U id, INT8U ext, INT8U len, const INT8U *data) {
+	uint16_t n;
+
+	if(id != this->rx_id || ext != this->ext)
+		return false;
+	if(len == 0)
+		return true;
+
+	switch(data[0] & 0xF0) {
+	case CAN_ISOTP_SINGLE:
+		n = data[0] & 0x0F;
+		if(n == 0 || n >= len)
+			break;
+		if(this->rx_active) {
+			// A new message abandons the one in progress
+			this->rx_active = false;
+			this->stats.rx_errors++;
+		}
+		if(this->rx_complete || n > this->rx_size) {
+			this->stats.rx_overflows++;
+			break;
+		}
+		memcpy(this->rx_buffer, data + 1, n);
+		this->rx_complete = n;
+		this->stats.received++;
+		break;
+
+	case CAN_ISOTP_FIRST:
+		n = ((data[0] & 0x0F) << 8) | data[1];
+		if(n < MAX_CHAR_IN_MESSAGE || len < MAX_CHAR_IN_MESSAGE)
+			break;
+		if(this->rx_active) {
+			this->rx_active = false;
+			this->stats.rx_errors++;
+		}
+		if(this->rx_complete || n > this->rx_size) {
+			this->stats.rx_overflows++;
+			this->rx_flow = CAN_ISOTP_FLOW_OVERFLOW;
+			break;
+		}
+		memcpy(this->rx_buffer, data + 2, 6);
+		this->rx_len = n;
+		this->rx_offset = 6;
+		this->rx_seq = 1;
+		this->rx_active = true;
+		this->rx_block_left = this->rx_block_size;
+		this->rx_last = millis();
+		this->rx_flow = CAN_ISOTP_FLOW_CTS;
+		break;
+
+	case CAN_ISOTP_CONSECUTIVE:
+		if(!this->rx_active)
+			break;
+		if((data[0] & 0x0F) != this->rx_seq) {
+			this->rx_active = false;
+			this->stats.rx_errors++;
+			break;
+		}
+		n = this->rx_len - this->rx_offset;
+		if(n > 7)
+			n = 7;
+		if(n > len - 1)
+			n = len - 1;
+		memcpy(this->rx_buffer + this->rx_offset, data + 1, n);
+		this->rx_offset += n;
+		this->rx_seq = (this->rx_seq + 1) & 0x0F;
+		this->rx_last = millis();
+		if(this->rx_offset >= this->rx_len) {
+			this->rx_active = false;
+			this->rx_complete = this->rx_len;
+			this->stats.received++;
+		} else if(this->rx_block_size > 0 && --this->rx_block_left == 0) {
+			this->rx_block_left = this->rx_block_size;
+			this->rx_flow = CAN_ISOTP_FLOW_CTS;
+		}
+		break;
+
+	case CAN_ISOTP_FLOW:
+		this->receiveFlowControl(len, data);
+		break;
+	}
+	return true;
+}
+
+// Reads up to max_frames frames from the controller, discarding those for
+// other IDs, then sends any flow control they call for, checks timeouts and
+// loads more of the message being sent. Pass 0 if frames reach
+// receive() another way. Call as often as possible. Returns the number of
+// frames read.
+uint8_t CANIsoTP::service(uint8_t max_frames) {
+	uint8_t handled = 0;
+	while(handled < max_frames && this->can->checkReceive() == CAN_MSGAVAIL) {
+		INT8U len, data[MAX_CHAR_IN_MESSAGE];
+		this->can->readMsgBuf(&len, data);
+		handled++;
+		if(!this->can->isRemoteRequest())
+			this->receive(this->can->getCanId(), this->can->isExtendedFrame(), len, data);
+	}
+
+	this->sendFlowControl();
+	uint32_t now = millis();
+	if(this->rx_active && (uint32_t)(now - this->rx_last) >= CAN_ISOTP_TIMEOUT_MS) {
+		this->rx_active = false;
+		this->stats.rx_errors++;
+	}
+	if(this->tx_status == CAN_ISOTP_BUSY && this->tx_waiting &&
+	   (uint32_t)(now - this->tx_wait_start) >= CAN_ISOTP_TIMEOUT_MS)
+		this->tx_status = CAN_ISOTP_TIMEOUT;
+	this->transmit();
+	return handled;
+}
+
+// Length of the received message in the buffer, or 0 if there is none
+uint16_t CANIsoTP::available() {
+	return this->rx_complete;
+}
+
+// Frees the buffer for the next message
+void CANIsoTP::release() {
+	this->rx_complete = 0;
+}
+
+CANIsoTPStats *CANIsoTP::getStats() {
+	return &this->stats;
+}
+
+// Install with can.addFrameHook(CANIsoTP::frameHook, &isotp) when other code
+// reads the controller, and call service(0) to answer flow control and keep
+// sending.
+void CANIsoTP::frameHook(void *context, INT8U dir, INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *buf) {
+	if(dir == MCP_FRAME_RX && !rtr)
+		((CANIsoTP *)context)->receive(id, ext, len, buf);
+}
@@ -0,0 +1,120 @@
+/*
+  can_isotp.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _CAN_ISOTP_H_
+#define _CAN_ISOTP_H_
+
+#include "mcp_can.h"
+
+// Longest message a first frame can announce on classic CAN
+#define CAN_ISOTP_MAX_LENGTH 4095
+// N_Bs / N_Cr: how long to wait for the peer's next flow control or
+// consecutive frame, in ms
+#ifndef CAN_ISOTP_TIMEOUT_MS
+#define CAN_ISOTP_TIMEOUT_MS 1000
+#endif
+// Flow control WAIT frames accepted in a row before giving up
+#ifndef CAN_ISOTP_MAX_WAITS
+#define CAN_ISOTP_MAX_WAITS 10
+#endif
+// Every frame is sent 8 bytes long, padded with this
+#ifndef CAN_ISOTP_PADDING
+#define CAN_ISOTP_PADDING 0xCC
+#endif
+
+// Outcome of the last send()
+#define CAN_ISOTP_DONE 0
+#define CAN_ISOTP_BUSY 1
+#define CAN_ISOTP_TIMEOUT 2                // no flow control from the peer in time
+#define CAN_ISOTP_OVERFLOW 3               // the peer has no room for the message
+
+typedef struct {
+  uint32_t sent;                    // messages
+  uint32_t received;
+  uint32_t rx_errors;               // out of sequence or late consecutive frames
+  uint32_t rx_overflows;            // too long for the buffer, or arrived before release()
+} CANIsoTPStats;
+
+// One ISO 15765-2 (ISO-TP) connection: messages of up to 4095 bytes sent as
+// single frames, or as a first frame and consecutive frames paced by the
+// receiver's flow control. Frames for the peer go out with tx_id and frames
+// from it arrive with rx_id.
+//
+// Nothing here blocks: send() and the received frames only change state, and
+// service() loads consecutive frames and flow control into whatever transmit
+// buffers are free. With no separation time requested, consecutive frames
+// fill every free buffer, so begin() turns on ordered transmission on the
+// controller to keep them in sequence. Received messages are reassembled
+// into the buffer passed to begin() and stay there until release().
+class CANIsoTP {
+private:
+    MCP_CAN *can;
+    INT32U tx_id;
+    INT32U rx_id;
+    INT8U ext;
+    CANIsoTPStats stats;
+
+    // Sending
+    const uint8_t *tx_data;
+    uint16_t tx_len;
+    uint16_t tx_offset;
+    uint8_t tx_status;
+    uint8_t tx_seq;
+    bool tx_waiting;                // for flow control
+    uint8_t tx_block_size;          // from the peer's flow control; 0 = unlimited
+    uint8_t tx_block_left;
+    uint8_t tx_waits;
+    uint32_t tx_st_min;             // us
+    uint32_t tx_last;               // micros() at the last consecutive frame
+    uint32_t tx_wait_start;         // millis() when we began waiting for flow control
+
+    // Receiving
+    uint8_t *rx_buffer;
+    uint16_t rx_size;
+    uint16_t rx_len;
+    uint16_t rx_offset;
+    uint16_t rx_complete;           // length of a message waiting for release()
+    bool rx_active;
+    uint8_t rx_seq;
+    uint8_t rx_block_size;          // what we ask of the peer
+    uint8_t rx_st_min;
+    uint8_t rx_block_left;
+    int8_t rx_flow;                 // flow control to send, or -1
+    uint32_t rx_last;               // millis() at the last frame of the message
+
+    bool sendFrame(const uint8_t *data, uint8_t len);
+    void sendFlowControl();
+    void receiveFlowControl(INT8U len, const INT8U *data);
+    void transmit();
+
+public:
+    CANIsoTP(MCP_CAN *can, INT32U tx_id, INT32U rx_id, INT8U ext);
+    void begin(uint8_t *rx_buffer, uint16_t rx_size, uint8_t block_size = 0, uint8_t st_min = 0);
+    bool send(const uint8_t *data, uint16_t len);
+    uint8_t getTxStatus();
+    bool receive(INT32U id, INT8U ext, INT8U len, const INT8U *data);
+    uint8_t service(uint8_t max_frames);
+    uint16_t available();
+    void release();
+    CANIsoTPStats *getStats();
+
+    static void frameHook(void *context, INT8U dir, INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *buf);
+};
+
+#endif
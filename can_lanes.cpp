@@ -0,0 +1,130 @@
+#include <Arduino.h>
+#include "can_lanes.h"
+
+// The controller has two receive buffers
+#define CAN_LANE_RX_BUFFERS 2
+
+CANReceiveLanes::CANReceiveLanes(MCP_CAN *can, CANFramePool *pool) {
+	this->can = can;
+	this->pool = pool;
+	this->lanes = NULL;
+	this->n_lanes = 0;
+	this->dropped = 0;
+}
+
+// Routes each filter to the most urgent lane that claims it. Every queue
+// must take its frames from this object's pool.
+void CANReceiveLanes::begin(CANLane *lanes, uint8_t n_lanes) {
+	this->lanes = lanes;
+	this->n_lanes = n_lanes;
+	this->dropped = 0;
+	for(uint8_t filter = 0; filter < CAN_LANE_FILTERS; filter++) {
+		this->route[filter] = n_lanes - 1;
+		for(uint8_t i = 0; i < n_lanes; i++) {
+			if(lanes[i].filters & CAN_LANE_FILTER(filter)) {
+				this->route[filter] = i;
+				break;
+			}
+		}
+	}
+}
+
+// Index of the lane frames matching filter go to, or CAN_LANE_NONE
+uint8_t CANReceiveLanes::getLane(INT8U filter) {
+	if(this->n_lanes == 0 || filter >= CAN_LANE_FILTERS)
+		return CAN_LANE_NONE;
+	return this->route[filter];
+}
+
+// Queues a frame on the lane for filter, stamped with micros(). Returns
+// false, and counts it dropped, if the lane or the pool is full.
+bool CANReceiveLanes::store(INT8U filter, INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *data) {
+	uint8_t lane = this->getLane(filter);
+	CANFrame *frame = lane == CAN_LANE_NONE ? NULL : this->pool->allocate();
+	if(frame == NULL) {
+		this->dropped++;
+		return false;
+	}
+
+	if(len > MAX_CHAR_IN_MESSAGE)
+		len = MAX_CHAR_IN_MESSAGE;
+	frame->id = id;
+	frame->ext = ext;
+	frame->rtr = rtr;
+	frame->len = len;
+	memcpy(frame->data, data, len);
+	frame->stamp = micros();
+	if(!this->lanes[lane].queue->push(frame)) {
+		this->pool->release(frame);
+		this->dropped++;
+		return false;
+	}
+	return true;
+}
+
+// Moves whatever the controller holds into the lanes. Reads no more than
+// there are receive buffers, so it returns in bounded time however busy
+// the bus is. Returns the number of frames read.
+uint8_t CANReceiveLanes::receive() {
+	uint8_t read = 0;
+	while(read < CAN_LANE_RX_BUFFERS && this->can->checkReceive() == CAN_MSGAVAIL) {
+		INT8U len, data[MAX_CHAR_IN_MESSAGE];
+		this->can->readMsgBuf(&len, data);
+		read++;
+		this->store(this->can->getFilterHit(), this->can->getCanId(), this->can->isExtendedFrame(),
+		            this->can->isRemoteRequest(), len, data);
+	}
+	return read;
+}
+
+// Passes up to max_frames frames to their lanes' handlers, always from the
+// most urgent lane with a frame waiting. With drain, the controller is
+// emptied into the lanes before each one.
+uint8_t CANReceiveLanes::dispatch(uint8_t max_frames, bool drain) {
+	uint8_t handled = 0;
+
+	while(handled < max_frames) {
+		if(drain)
+			this->receive();
+		CANLane *lane = NULL;
+		CANFrame *frame = NULL;
+		for(uint8_t i = 0; i < this->n_lanes && frame == NULL; i++) {
+			lane = &this->lanes[i];
+			if(lane->handler)
+				frame = lane->queue->pop();
+		}
+		if(frame == NULL)
+			break;
+		lane->handler(frame);
+		this->pool->release(frame);
+		handled++;
+	}
+	return handled;
+}
+
+// Reads the controller and handles up to max_frames frames. Call as often
+// as possible. Returns the number handled.
+uint8_t CANReceiveLanes::service(uint8_t max_frames) {
+	uint8_t handled = this->dispatch(max_frames, true);
+	this->receive();
+	return handled;
+}
+
+// Handles up to max_frames frames already queued, e.g. by frameHook,
+// without touching the controller
+uint8_t CANReceiveLanes::dispatch(uint8_t max_frames) {
+	return this->dispatch(max_frames, false);
+}
+
+// Frames lost because their lane or the pool was full
+uint32_t CANReceiveLanes::getDropped() {
+	return this->dropped;
+}
+
+// Install with can.addFrameHook(CANReceiveLanes::frameHook, &lanes) to sort
+// frames read by other code, e.g. uCAN, and call dispatch() to hand them out.
+void CANReceiveLanes::frameHook(void *context, INT8U dir, INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *buf) {
+	CANReceiveLanes *lanes = (CANReceiveLanes *)context;
+	if(dir == MCP_FRAME_RX)
+		lanes->store(lanes->can->getFilterHit(), id, ext, rtr, len, buf);
+}
@@ -0,0 +1,83 @@
+/*
+  can_lanes.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _CAN_LANES_H_
+#define _CAN_LANES_H_
+
+#include "mcp_can.h"
+#include "can_pool.h"
+
+#define CAN_LANE_FILTERS 6
+#define CAN_LANE_NONE 0xFF
+
+// Acceptance filters a lane takes frames from: bit n is RXFn
+#define CAN_LANE_FILTER(n) (1 << (n))
+#define CAN_LANE_RXB0 0x03                  // RXF0 and RXF1
+#define CAN_LANE_RXB1 0x3C                  // RXF2 to RXF5
+
+// Called with each frame taken from a lane. The frame goes back to the pool
+// when it returns.
+typedef void (*CANLaneHandler)(CANFrame *frame);
+
+// One receive queue. Tables passed to CANReceiveLanes::begin are in priority
+// order, most urgent first. Each queue has its own depth, which bounds how
+// much of the pool its traffic can hold.
+typedef struct {
+  uint8_t filters;                  // CAN_LANE_FILTER bits
+  CANFrameQueue *queue;
+  CANLaneHandler handler;           // or NULL to leave frames for queue->pop()
+} CANLane;
+
+// Sorts received frames into software queues by the acceptance filter they
+// matched, so a flood on one filter can't delay frames on another. Filters
+// no lane claims feed the last lane. Frames come either from service(), which
+// drains the controller, or from whatever else reads it, with frameHook
+// installed as its frame hook and dispatch() handing them out.
+//
+// service() hands out frames most urgent lane first, and empties both
+// receive buffers into the queues before every handler call. A frame that
+// matched an urgent filter therefore waits for at most one handler already
+// running on a less urgent lane. To keep background floods from taking
+// every frame, give the lanes their own pool, or depths that sum to less
+// than the shared one.
+class CANReceiveLanes {
+private:
+    MCP_CAN *can;
+    CANFramePool *pool;
+    CANLane *lanes;
+    uint8_t n_lanes;
+    uint8_t route[CAN_LANE_FILTERS];  // lane for each filter
+    uint32_t dropped;
+
+    uint8_t dispatch(uint8_t max_frames, bool drain);
+
+public:
+    CANReceiveLanes(MCP_CAN *can = &CAN, CANFramePool *pool = &CANPool);
+    void begin(CANLane *lanes, uint8_t n_lanes);
+    uint8_t getLane(INT8U filter);
+    bool store(INT8U filter, INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *data);
+    uint8_t receive();
+    uint8_t service(uint8_t max_frames);
+    uint8_t dispatch(uint8_t max_frames);
+    uint32_t getDropped();
+
+    static void frameHook(void *context, INT8U dir, INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *buf);
+};
+
+#endif
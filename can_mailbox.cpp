@@ -0,0 +1,120 @@
+#include <Arduino.h>
+#include "can_mailbox.h"
+
+// Stops the compiler moving mailbox accesses across the sequence updates.
+// Single-core MCUs need nothing more.
+#define CAN_MAILBOX_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+CANMailboxes::CANMailboxes(MCP_CAN *can) {
+	this->can = can;
+	this->boxes = NULL;
+	this->n_boxes = 0;
+	this->received = 0;
+	this->unmatched = 0;
+}
+
+void CANMailboxes::begin(CANMailbox *boxes, uint8_t n_boxes) {
+	this->boxes = boxes;
+	this->n_boxes = n_boxes;
+	this->received = 0;
+	this->unmatched = 0;
+}
+
+// Binary search over the table, ordered by (ext, id). Returns the index of
+// the mailbox for id, or CAN_MAILBOX_NONE. Mailboxes never move, so callers
+// can look an ID up once and read it by index from then on.
+uint8_t CANMailboxes::find(INT32U id, INT8U ext) {
+	uint8_t lo = 0, hi = this->n_boxes;
+	while(lo < hi) {
+		uint8_t mid = (lo + hi) / 2;
+		CANMailbox *box = &this->boxes[mid];
+		if(ext < box->ext || (ext == box->ext && id < box->id))
+			hi = mid;
+		else if(ext > box->ext || id > box->id)
+			lo = mid + 1;
+		else
+			return mid;
+	}
+	return CAN_MAILBOX_NONE;
+}
+
+// Overwrites the mailbox for id. Returns false if there is none.
+bool CANMailboxes::store(INT32U id, INT8U ext, INT8U len, const INT8U *data) {
+	this->received++;
+	uint8_t index = this->find(id, ext);
+	if(index == CAN_MAILBOX_NONE) {
+		this->unmatched++;
+		return false;
+	}
+
+	CANMailbox *box = &this->boxes[index];
+	if(len > MAX_CHAR_IN_MESSAGE)
+		len = MAX_CHAR_IN_MESSAGE;
+	box->seq++;
+	CAN_MAILBOX_BARRIER();
+	box->len = len;
+	memcpy(box->data, data, len);
+	box->stamp = millis();
+	CAN_MAILBOX_BARRIER();
+	box->seq++;
+	return true;
+}
+
+// Reads up to max_frames frames from the controller into their mailboxes.
+// Remote frames carry no value and are discarded. Returns the number read.
+uint8_t CANMailboxes::service(uint8_t max_frames) {
+	uint8_t handled = 0;
+	while(handled < max_frames && this->can->checkReceive() == CAN_MSGAVAIL) {
+		INT8U len, data[MAX_CHAR_IN_MESSAGE];
+		this->can->readMsgBuf(&len, data);
+		handled++;
+		if(!this->can->isRemoteRequest())
+			this->store(this->can->getCanId(), this->can->isExtendedFrame(), len, data);
+	}
+	return handled;
+}
+
+// Copies out a consistent snapshot of a mailbox, retrying if a writer got in
+// part way through. Returns its sequence number, which changes whenever a
+// new frame arrives and is 0 if none has yet.
+uint8_t CANMailboxes::read(uint8_t index, INT8U *len, INT8U *data) {
+	CANMailbox *box = &this->boxes[index];
+	uint8_t seq;
+	do {
+		while((seq = box->seq) & 1);
+		CAN_MAILBOX_BARRIER();
+		*len = box->len;
+		memcpy(data, box->data, box->len);
+		CAN_MAILBOX_BARRIER();
+	} while(box->seq != seq);
+	return seq;
+}
+
+// Cheap change detection: compare with the value read() last returned
+uint8_t CANMailboxes::sequence(uint8_t index) {
+	return this->boxes[index].seq & ~1;
+}
+
+uint32_t CANMailboxes::getReceived() {
+	return this->received;
+}
+
+uint32_t CANMailboxes::getUnmatched() {
+	return this->unmatched;
+}
+
+// Fills the mailboxes from frames read by other code, e.g. uCAN or receive
+// lanes, through the driver's frame hooks. Don't call service() as well, or
+// every frame is stored twice. Returns false if no hook slot is free.
+bool CANMailboxes::attach() {
+	return this->can->addFrameHook(CANMailboxes::frameHook, this) == CAN_OK;
+}
+
+void CANMailboxes::detach() {
+	this->can->removeFrameHook(CANMailboxes::frameHook, this);
+}
+
+void CANMailboxes::frameHook(void *context, INT8U dir, INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *buf) {
+	if(dir == MCP_FRAME_RX && !rtr)
+		((CANMailboxes *)context)->store(id, ext, len, buf);
+}
@@ -0,0 +1,74 @@
+/*
+  can_mailbox.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _CAN_MAILBOX_H_
+#define _CAN_MAILBOX_H_
+
+#include "mcp_can.h"
+
+#define CAN_MAILBOX_NONE 0xFF
+
+// Latest value of one CAN ID. Tables passed to CANMailboxes::begin must be
+// sorted by ext, then id; declare them with CAN_MAILBOX so the rest starts
+// out zero.
+typedef struct {
+  INT32U id;
+  INT8U ext;
+
+  // Maintained by the mailboxes
+  volatile uint8_t seq;             // odd while being written, 0 until the first frame, wraps every 128
+  INT8U len;
+  INT8U data[MAX_CHAR_IN_MESSAGE];
+  uint32_t stamp;                   // millis() when last written
+} CANMailbox;
+
+#define CAN_MAILBOX(id, ext) {(id), (ext), 0, 0, {0}, 0}
+
+// Keeps the newest frame for each ID in a fixed table instead of queueing
+// them, so a slow reader sees current state rather than a backlog, and
+// receive overruns only ever lose stale values. Frames come either from
+// service(), which drains the controller, or, after attach(), from whatever
+// else reads it, alongside the driver's other frame hooks. Writers may run
+// in an interrupt handler and readers in the main loop, but not the other
+// way round: a reader that interrupts a write would wait for it forever.
+class CANMailboxes {
+private:
+    MCP_CAN *can;
+    CANMailbox *boxes;
+    uint8_t n_boxes;
+    uint32_t received;
+    uint32_t unmatched;
+
+public:
+    CANMailboxes(MCP_CAN *can = &CAN);
+    void begin(CANMailbox *boxes, uint8_t n_boxes);
+    uint8_t find(INT32U id, INT8U ext);
+    bool store(INT32U id, INT8U ext, INT8U len, const INT8U *data);
+    uint8_t service(uint8_t max_frames);
+    bool attach();
+    void detach();
+    uint8_t read(uint8_t index, INT8U *len, INT8U *data);
+    uint8_t sequence(uint8_t index);
+    uint32_t getReceived();
+    uint32_t getUnmatched();
+
+    static void frameHook(void *context, INT8U dir, INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *buf);
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include <Arduino.h>
+#include "can_pool.h"
+
+CANFramePool CANPool;
+
+CANFramePool::CANFramePool() {
+	for(uint8_t i = 0; i < CAN_FRAME_POOL_SIZE; i++)
+		this->next[i] = i + 1 < CAN_FRAME_POOL_SIZE ? i + 1 : CAN_FRAME_NONE;
+	this->free_head = 0;
+	this->used = 0;
+	this->high_water = 0;
+}
+
+CANFrame *CANFramePool::allocate() {
+	CANFrame *frame = NULL;
+
+	CAN_ATOMIC_BEGIN();
+	if(this->free_head != CAN_FRAME_NONE) {
+		frame = &this->frames[this->free_head];
+		this->free_head = this->next[this->free_head];
+		if(++this->used > this->high_water)
+			this->high_water = this->used;
+	}
+	CAN_ATOMIC_END();
+
+	return frame;
+}
+
+void CANFramePool::release(CANFrame *frame) {
+	uint8_t index = frame - this->frames;
+
+	CAN_ATOMIC_BEGIN();
+	this->next[index] = this->free_head;
+	this->free_head = index;
+	this->used--;
+	CAN_ATOMIC_END();
+}
+
+uint8_t CANFramePool::available() {
+	return CAN_FRAME_POOL_SIZE - this->used;
+}
+
+uint8_t CANFramePool::highWater() {
+	return this->high_water;
+}
+
+void CANFramePool::resetHighWater() {
+	this->high_water = this->used;
+}
+
+CANFrameQueue::CANFrameQueue(CANFramePool *pool, uint8_t depth) {
+	this->pool = pool;
+	this->head = CAN_FRAME_NONE;
+	this->tail = CAN_FRAME_NONE;
+	this->count = 0;
+	this->depth = depth;
+	this->high_water = 0;
+	this->overruns = 0;
+}
+
+// Appends a frame from this queue's pool. Returns false, leaving the frame
+// with the caller, if the queue is already depth frames long.
+bool CANFrameQueue::push(CANFrame *frame) {
+	uint8_t index = frame - this->pool->frames;
+	bool ret = false;
+
+	CAN_ATOMIC_BEGIN();
+	if(this->count < this->depth) {
+		this->pool->next[index] = CAN_FRAME_NONE;
+		if(this->tail == CAN_FRAME_NONE)
+			this->head = index;
+		else
+			this->pool->next[this->tail] = index;
+		this->tail = index;
+		if(++this->count > this->high_water)
+			this->high_water = this->count;
+		ret = true;
+	} else {
+		this->overruns++;
+	}
+	CAN_ATOMIC_END();
+
+	return ret;
+}
+
+CANFrame *CANFrameQueue::pop() {
+	CANFrame *frame = NULL;
+
+	CAN_ATOMIC_BEGIN();
+	if(this->head != CAN_FRAME_NONE) {
+		frame = &this->pool->frames[this->head];
+		this->head = this->pool->next[this->head];
+		if(this->head == CAN_FRAME_NONE)
+			this->tail = CAN_FRAME_NONE;
+		this->count--;
+	}
+	CAN_ATOMIC_END();
+
+	return frame;
+}
+
+CANFrame *CANFrameQueue::peek() {
+	return this->head == CAN_FRAME_NONE ? NULL : &this->pool->frames[this->head];
+}
+
+// Copies a frame into the pool and appends it, keeping at most
+// MAX_CHAR_IN_MESSAGE data bytes. Returns false and counts an overrun if the
+// pool is exhausted or the queue is full.
+bool CANFrameQueue::enqueue(INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *data) {
+	CANFrame *frame = this->pool->allocate();
+	if(frame == NULL) {
+		CAN_ATOMIC_BEGIN();
+		this->overruns++;
+		CAN_ATOMIC_END();
+		return false;
+	}
+
+	if(len > MAX_CHAR_IN_MESSAGE)
+		len = MAX_CHAR_IN_MESSAGE;
+	frame->id = id;
+	frame->ext = ext;
+	frame->rtr = rtr;
+	frame->len = len;
+	if(data)
+		memcpy(frame->data, data, len);
+	if(!this->push(frame)) {
+		this->pool->release(frame);
+		return false;
+	}
+	return true;
+}
+
+uint8_t CANFrameQueue::size() {
+	return this->count;
+}
+
+uint8_t CANFrameQueue::highWater() {
+	return this->high_water;
+}
+
+uint16_t CANFrameQueue::getOverruns() {
+	return this->overruns;
+}
@@ -0,0 +1,88 @@
+/*
+  can_pool.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _CAN_POOL_H_
+#define _CAN_POOL_H_
+
+#include "mcp_can.h"
+
+// Number of frames in the shared pool. At most 254 so an index fits a byte.
+#ifndef CAN_FRAME_POOL_SIZE
+#define CAN_FRAME_POOL_SIZE 16
+#endif
+#define CAN_FRAME_NONE 0xFF
+
+typedef struct {
+  INT32U id;
+  INT8U ext;
+  INT8U rtr;
+  INT8U len;
+  INT8U data[MAX_CHAR_IN_MESSAGE];
+  uint32_t stamp;                   // free for the owner, e.g. time received or sent
+} CANFrame;
+
+// Fixed-capacity frame storage with O(1) allocate and free. Free frames and
+// queued frames are chained through a byte-wide next index per entry, so the
+// only overhead is one byte per frame. Safe to use from interrupt handlers.
+class CANFramePool {
+private:
+    CANFrame frames[CAN_FRAME_POOL_SIZE];
+    uint8_t next[CAN_FRAME_POOL_SIZE];
+    uint8_t free_head;
+    uint8_t used;
+    uint8_t high_water;
+
+    friend class CANFrameQueue;
+
+public:
+    CANFramePool();
+    CANFrame *allocate();
+    void release(CANFrame *frame);
+    uint8_t available();
+    uint8_t highWater();
+    void resetHighWater();
+};
+
+// FIFO of frames borrowed from a pool, limited to depth entries. Frames are
+// allocated with the pool, filled in, and handed over with push(); pop()
+// returns ownership to the caller, who must release() it back to the pool.
+class CANFrameQueue {
+private:
+    CANFramePool *pool;
+    uint8_t head;
+    uint8_t tail;
+    uint8_t count;
+    uint8_t depth;
+    uint8_t high_water;
+    uint16_t overruns;
+
+public:
+    CANFrameQueue(CANFramePool *pool, uint8_t depth);
+    bool push(CANFrame *frame);
+    CANFrame *pop();
+    CANFrame *peek();
+    bool enqueue(INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *data);
+    uint8_t size();
+    uint8_t highWater();
+    uint16_t getOverruns();
+};
+
+extern CANFramePool CANPool;
+
+#endif
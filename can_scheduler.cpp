@@ -0,0 +1,115 @@
+#include <Arduino.h>
+#include "can_scheduler.h"
+
+CANScheduler::CANScheduler(MCP_CAN *can) {
+	this->can = can;
+	this->ready = NULL;
+	for(uint8_t i = 0; i < CAN_SCHEDULER_WHEEL_SLOTS; i++)
+		this->wheel[i] = NULL;
+	this->tick = 0;
+}
+
+// Call once the clock is running, before adding frames
+void CANScheduler::begin() {
+	this->tick = millis();
+}
+
+void CANScheduler::insert(CyclicFrame *frame) {
+	CyclicFrame **slot = &this->wheel[frame->due & (CAN_SCHEDULER_WHEEL_SLOTS - 1)];
+	frame->next = *slot;
+	*slot = frame;
+}
+
+// Frames that are due wait on the ready list in CAN ID order, so when the
+// transmit buffers are scarce the highest priority frame is loaded first.
+void CANScheduler::makeReady(CyclicFrame *frame) {
+	CyclicFrame **pos = &this->ready;
+	while(*pos != NULL && (*pos)->id <= frame->id)
+		pos = &(*pos)->next;
+	frame->next = *pos;
+	*pos = frame;
+}
+
+bool CANScheduler::unlink(CyclicFrame **list, CyclicFrame *frame) {
+	for(; *list != NULL; list = &(*list)->next) {
+		if(*list == frame) {
+			*list = frame->next;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Schedules frame every period ms, first sending it phase ms from now. A
+// frame that is already scheduled is rescheduled, e.g. to change its period.
+void CANScheduler::add(CyclicFrame *frame, uint16_t period, uint16_t phase) {
+	this->remove(frame);
+	frame->period = period ? period : 1;
+	frame->due = millis() + phase;
+	this->resetStatistics(frame);
+	// service() has already passed the slot for a frame due now
+	if((int32_t)(frame->due - this->tick) <= 0)
+		this->makeReady(frame);
+	else
+		this->insert(frame);
+}
+
+void CANScheduler::remove(CyclicFrame *frame) {
+	if(!this->unlink(&this->wheel[frame->due & (CAN_SCHEDULER_WHEEL_SLOTS - 1)], frame))
+		this->unlink(&this->ready, frame);
+}
+
+void CANScheduler::resetStatistics(CyclicFrame *frame) {
+	frame->sent = 0;
+	frame->skipped = 0;
+	frame->late_max = 0;
+	frame->late_total = 0;
+}
+
+// Releases every frame that has come due into the controller's transmit
+// buffers. Call as often as possible; jitter is bounded by the interval
+// between calls plus the time the bus is busy with higher priority traffic.
+void CANScheduler::service() {
+	uint32_t now = millis();
+
+	// Advance the wheel one slot per elapsed ms, but never visit a slot twice
+	uint32_t elapsed = now - this->tick;
+	if(elapsed > CAN_SCHEDULER_WHEEL_SLOTS)
+		this->tick = now - CAN_SCHEDULER_WHEEL_SLOTS;
+	while(this->tick != now) {
+		this->tick++;
+		CyclicFrame **slot = &this->wheel[this->tick & (CAN_SCHEDULER_WHEEL_SLOTS - 1)];
+		while(*slot != NULL) {
+			CyclicFrame *frame = *slot;
+			if((int32_t)(frame->due - now) <= 0) {
+				*slot = frame->next;
+				this->makeReady(frame);
+			} else {
+				slot = &frame->next;
+			}
+		}
+	}
+
+	// Load ready frames until the transmit buffers are full
+	while(this->ready != NULL) {
+		CyclicFrame *frame = this->ready;
+		if(this->can->trySendMsgBuf(frame->id, frame->ext, frame->len, frame->data) != CAN_OK)
+			break;
+		this->ready = frame->next;
+
+		uint32_t late = now - frame->due;
+		if(late > frame->late_max)
+			frame->late_max = late > 0xFFFF ? 0xFFFF : late;
+		frame->late_total += late;
+		frame->sent++;
+
+		// If we fell more than a period behind, drop the missed transmissions
+		// rather than sending a burst to catch up.
+		frame->due += frame->period;
+		while((int32_t)(frame->due - now) <= 0) {
+			frame->due += frame->period;
+			frame->skipped++;
+		}
+		this->insert(frame);
+	}
+}
@@ -0,0 +1,70 @@
+/*
+  can_scheduler.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _CAN_SCHEDULER_H_
+#define _CAN_SCHEDULER_H_
+
+#include "mcp_can.h"
+
+// Number of 1ms slots in the timer wheel; must be a power of two. Frames due
+// further ahead than this wait in their slot for the wheel to come round again.
+#ifndef CAN_SCHEDULER_WHEEL_SLOTS
+#define CAN_SCHEDULER_WHEEL_SLOTS 32
+#endif
+
+// A periodic frame. The application owns the storage and may update data
+// between transmissions; the remaining fields are maintained by the scheduler.
+typedef struct CyclicFrame {
+  INT32U id;
+  INT8U ext;
+  INT8U len;
+  INT8U data[MAX_CHAR_IN_MESSAGE];
+
+  uint16_t period;
+  uint32_t due;
+  struct CyclicFrame *next;
+
+  // Jitter statistics: how late each transmission was loaded, in ms
+  uint16_t sent;
+  uint16_t skipped;
+  uint16_t late_max;
+  uint32_t late_total;
+} CyclicFrame;
+
+class CANScheduler {
+private:
+    MCP_CAN *can;
+    CyclicFrame *wheel[CAN_SCHEDULER_WHEEL_SLOTS];
+    CyclicFrame *ready;
+    uint32_t tick;
+
+    void insert(CyclicFrame *frame);
+    void makeReady(CyclicFrame *frame);
+    bool unlink(CyclicFrame **list, CyclicFrame *frame);
+
+public:
+    CANScheduler(MCP_CAN *can);
+    void begin();
+    void add(CyclicFrame *frame, uint16_t period, uint16_t phase);
+    void remove(CyclicFrame *frame);
+    void service();
+    void resetStatistics(CyclicFrame *frame);
+};
+
+#endif
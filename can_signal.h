@@ -0,0 +1,148 @@
+/*
+  can_signal.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _CAN_SIGNAL_H_
+#define _CAN_SIGNAL_H_
+
+#include "mcp_can.h"
+
+/*
+  Declarative packing of signals in frame payloads, in the style of a DBC
+  file. A message is an X-macro listing its signals:
+
+    #define ENGINE_SIGNALS(S) \
+      S(rpm,     float,   24, 16, CAN_SIGNAL_INTEL, unsigned, 0.25, 0) \
+      S(coolant, int16_t, 8,  8,  CAN_SIGNAL_INTEL, unsigned, 1,    -40)
+    CAN_MESSAGE(Engine, 0x0C0, 0, 8, ENGINE_SIGNALS)
+
+  Each signal is S(name, type, start, length, order, signedness, scale,
+  offset): the physical value is raw * scale + offset, stored in a field of
+  type type. start is the bit number of the least significant bit for
+  CAN_SIGNAL_INTEL (little endian) signals and of the most significant bit
+  for CAN_SIGNAL_MOTOROLA (big endian) ones, numbered as in DBC files:
+  bit 0 is the LSB of byte 0 and bit 63 the MSB of byte 7. length is at most
+  32, and signedness is signed (two's complement) or unsigned.
+
+  CAN_MESSAGE(Name, id, ext, dlc, SIGNALS) then defines
+    struct Name                  one field per signal
+    Name_ID, Name_EXT, Name_DLC
+    Name_decode(data, &msg)      payload to struct
+    Name_encode(&msg, data)      struct to payload, returns the DLC
+    Name_send(can, &msg)         encodes and sends with sendMsgBuf
+
+  Every position, length and scale is a constant, so each signal compiles to
+  a handful of byte loads and shifts. Integer scales and offsets keep the
+  arithmetic integer; a float scale, offset or field type brings in float.
+*/
+#define CAN_SIGNAL_INTEL 1
+#define CAN_SIGNAL_MOTOROLA -1
+
+#define CAN_SIGNAL_INLINE static inline __attribute__((always_inline))
+
+// Byte holding the least significant bit of a signal, and that bit's place in
+// it. Motorola bit numbers are mapped to big-endian order first, where bit 7
+// of byte 0 comes first and the LSB is length - 1 places after the MSB.
+#define CAN_SIGNAL_LSB_BIT(start, length, order) \
+  ((order) == CAN_SIGNAL_INTEL ? (start) & 7 : ((((start) & ~7) + 7 - ((start) & 7) + (length) - 1) & 7) ^ 7)
+#define CAN_SIGNAL_LSB_BYTE(start, length, order) \
+  ((order) == CAN_SIGNAL_INTEL ? (start) >> 3 : (((start) & ~7) + 7 - ((start) & 7) + (length) - 1) >> 3)
+
+CAN_SIGNAL_INLINE uint32_t canSignalMask(uint8_t length) {
+	return length < 32 ? (1UL << length) - 1 : 0xFFFFFFFFUL;
+}
+
+// Gathers length bits whose LSB is bit shift of data[byte]; the more
+// significant bytes follow at byte + step, byte + 2 * step and so on
+CAN_SIGNAL_INLINE uint32_t canSignalGet(const INT8U *data, int8_t byte, uint8_t shift, uint8_t length, int8_t step) {
+	uint32_t raw = data[byte] >> shift;
+	if(length + shift > 8)
+		raw |= (uint32_t)data[byte + step] << (8 - shift);
+	if(length + shift > 16)
+		raw |= (uint32_t)data[byte + 2 * step] << (16 - shift);
+	if(length + shift > 24)
+		raw |= (uint32_t)data[byte + 3 * step] << (24 - shift);
+	if(length + shift > 32)
+		raw |= (uint32_t)data[byte + 4 * step] << (32 - shift);
+	return raw & canSignalMask(length);
+}
+
+CAN_SIGNAL_INLINE void canSignalSet(INT8U *data, int8_t byte, uint8_t shift, uint8_t length, int8_t step, uint32_t raw) {
+	uint32_t mask = canSignalMask(length);
+	raw &= mask;
+	data[byte] = (data[byte] & ~(uint8_t)(mask << shift)) | (uint8_t)(raw << shift);
+	if(length + shift > 8)
+		data[byte + step] = (data[byte + step] & ~(uint8_t)(mask >> (8 - shift))) | (uint8_t)(raw >> (8 - shift));
+	if(length + shift > 16)
+		data[byte + 2 * step] = (data[byte + 2 * step] & ~(uint8_t)(mask >> (16 - shift))) | (uint8_t)(raw >> (16 - shift));
+	if(length + shift > 24)
+		data[byte + 3 * step] = (data[byte + 3 * step] & ~(uint8_t)(mask >> (24 - shift))) | (uint8_t)(raw >> (24 - shift));
+	if(length + shift > 32)
+		data[byte + 4 * step] = (data[byte + 4 * step] & ~(uint8_t)(mask >> (32 - shift))) | (uint8_t)(raw >> (32 - shift));
+}
+
+CAN_SIGNAL_INLINE uint32_t canSignalGet_unsigned(const INT8U *data, int8_t byte, uint8_t shift, uint8_t length, int8_t step) {
+	return canSignalGet(data, byte, shift, length, step);
+}
+
+CAN_SIGNAL_INLINE int32_t canSignalGet_signed(const INT8U *data, int8_t byte, uint8_t shift, uint8_t length, int8_t step) {
+	uint32_t raw = canSignalGet(data, byte, shift, length, step);
+	if(length < 32 && (raw >> (length - 1)) & 1)
+		raw |= ~canSignalMask(length);
+	return (int32_t)raw;
+}
+
+// Physical value back to raw: integers as they are, floats rounded to nearest
+CAN_SIGNAL_INLINE uint32_t canSignalToRaw(int value) { return value; }
+CAN_SIGNAL_INLINE uint32_t canSignalToRaw(unsigned int value) { return value; }
+CAN_SIGNAL_INLINE uint32_t canSignalToRaw(long value) { return value; }
+CAN_SIGNAL_INLINE uint32_t canSignalToRaw(unsigned long value) { return value; }
+CAN_SIGNAL_INLINE uint32_t canSignalToRaw(float value) { return (int32_t)(value < 0 ? value - 0.5f : value + 0.5f); }
+CAN_SIGNAL_INLINE uint32_t canSignalToRaw(double value) { return (int32_t)(value < 0 ? value - 0.5 : value + 0.5); }
+
+#define CAN_SIGNAL_FIELD(name, type, start, length, order, sign, scale, offset) type name;
+
+// The raw value is converted to the field type before scaling, so integer
+// fields wrap the way the field would and float fields see the exact value
+#define CAN_SIGNAL_DECODE(name, type, start, length, order, sign, scale, offset) \
+  msg->name = (type)((type)canSignalGet_##sign(data, CAN_SIGNAL_LSB_BYTE(start, length, order), \
+    CAN_SIGNAL_LSB_BIT(start, length, order), (length), (order)) * (scale) + (offset));
+
+#define CAN_SIGNAL_ENCODE(name, type, start, length, order, sign, scale, offset) \
+  canSignalSet(data, CAN_SIGNAL_LSB_BYTE(start, length, order), CAN_SIGNAL_LSB_BIT(start, length, order), \
+    (length), (order), canSignalToRaw((msg->name - (offset)) / (scale)));
+
+#define CAN_MESSAGE(message, id, ext, dlc, SIGNALS) \
+  typedef struct { SIGNALS(CAN_SIGNAL_FIELD) } message; \
+  static const INT32U message##_ID = (id); \
+  static const INT8U message##_EXT = (ext); \
+  static const INT8U message##_DLC = (dlc); \
+  CAN_SIGNAL_INLINE void message##_decode(const INT8U *data, message *msg) { \
+    SIGNALS(CAN_SIGNAL_DECODE) \
+  } \
+  CAN_SIGNAL_INLINE INT8U message##_encode(const message *msg, INT8U *data) { \
+    memset(data, 0, (dlc)); \
+    SIGNALS(CAN_SIGNAL_ENCODE) \
+    return (dlc); \
+  } \
+  static inline INT8U message##_send(MCP_CAN *can, const message *msg) { \
+    INT8U data[MAX_CHAR_IN_MESSAGE]; \
+    return can->sendMsgBuf((id), (ext), message##_encode(msg, data), data); \
+  }
+
+#endif
@@ -0,0 +1,39 @@
+// demo: uCAN address server; nodes that start up after it get their node ID in one exchange
+// the allocation table lives in the first 786 bytes of EEPROM and survives resets
+#include <mcp_can.h>
+#include <uCAN.h>
+#include <ucan_address.h>
+#include <EEPROM.h>
+#include <SPI.h>
+
+HardwareID hardware_id = {{0x02, 0x00, 0x00, 0x00, 0x00, 0x00}};
+uCANAddressServer addresses(0);                 // EEPROM offset
+
+void setup()
+{
+  Serial.begin(115200);
+  addresses.load();
+  uCAN.configureAddressServer(&addresses);      // before begin(): our own ID comes from the table too
+  if(uCAN.begin(hardware_id) == CAN_OK) Serial.print("can init ok!!\r\n");
+  else Serial.print("Can init fail!!\r\n");
+
+  Serial.print("node ID ");
+  Serial.println(uCAN.getNodeID());
+}
+
+void loop()
+{
+  static uint8_t count;
+
+  uCAN.receive();                               // answers lookups as they arrive
+  if(addresses.getCount() != count)
+  {
+    count = addresses.getCount();
+    Serial.print("allocated ");
+    Serial.println(count);
+  }
+}
+
+/*********************************************************************************************************
+  END FILE
+*********************************************************************************************************/
@@ -0,0 +1,39 @@
+// demo: CAN-BUS Shield, print how much of the bus each ID is using
+#include <mcp_can.h>
+#include <can_busload.h>
+#include <SPI.h>
+
+CANBusLoad busload(&CAN);
+CANLoadEntry ids[16];                           // busiest IDs get their own row, the rest count as "other"
+
+void setup()
+{
+  Serial.begin(115200);
+  // init can bus, baudrate: 500k
+  if(CAN.begin(CAN_500KBPS) ==CAN_OK) Serial.print("can init ok!!\r\n");
+  else Serial.print("Can init fail!!\r\n");
+
+  busload.begin(500000, 250, ids, 16);          // 4 x 250ms buckets: a 1s sliding window
+}
+
+void loop()
+{
+  static unsigned long last;
+  unsigned char len = 0;
+  unsigned char buf[8];
+
+  if(CAN_MSGAVAIL == CAN.checkReceive())
+  {
+    CAN.readMsgBuf(&len, buf);                  // every frame read is accounted by the hook
+  }
+
+  if(millis() - last >= 1000)
+  {
+    last = millis();
+    busload.printTable(Serial);
+  }
+}
+
+/*********************************************************************************************************
+  END FILE
+*********************************************************************************************************/
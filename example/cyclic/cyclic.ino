@@ -0,0 +1,30 @@
+// demo: CAN-BUS Shield, send periodic data with the cyclic scheduler
+#include <mcp_can.h>
+#include <can_scheduler.h>
+#include <SPI.h>
+
+CANScheduler scheduler(&CAN);
+CyclicFrame status = {0x100, 0, 8, {0, 1, 2, 3, 4, 5, 6, 7}};
+CyclicFrame counter = {0x200, 0, 1, {0}};
+
+void setup()
+{
+  Serial.begin(115200);
+  // init can bus, baudrate: 500k
+  if(CAN.begin(CAN_500KBPS) ==CAN_OK) Serial.print("can init ok!!\r\n");
+  else Serial.print("Can init fail!!\r\n");
+
+  scheduler.begin();
+  scheduler.add(&status, 100, 0);               // id 0x100 every 100ms
+  scheduler.add(&counter, 10, 5);               // id 0x200 every 10ms, offset by 5ms
+}
+
+void loop()
+{
+  counter.data[0]++;                            // payload is picked up at the next transmission
+  scheduler.service();                          // release frames that are due, never blocks
+}
+
+/*********************************************************************************************************
+  END FILE
+*********************************************************************************************************/
@@ -0,0 +1,51 @@
+// demo: two CAN-BUS Shields bridged by a routing table
+// controller 0: /CS on pin 10, /INT on pin 2; controller 1: /CS on pin 9, /INT on pin 3
+#include <mcp_can.h>
+#include <can_gateway.h>
+#include <SPI.h>
+
+MCP_CAN CAN1(9);
+CANGateway gateway(&CAN, &CAN1);
+
+// sorted by channel, then format, then first ID
+CANRoute routes[] = {
+  {0, 0, 0x100, 0x1FF, 0,     0},               // 0x100-0x1FF: bus 0 -> bus 1 unchanged
+  {0, 0, 0x200, 0x2FF, 0xF00, 0x600},           // 0x2xx on bus 0 appears as 0x6xx on bus 1
+  {1, 0, 0x700, 0x7FF, 0,     0},               // diagnostics back from bus 1 -> bus 0
+};
+
+void setup()
+{
+  Serial.begin(115200);
+  if(CAN.begin(CAN_500KBPS) == CAN_OK && CAN1.begin(CAN_250KBPS) == CAN_OK) Serial.print("can init ok!!\r\n");
+  else Serial.print("Can init fail!!\r\n");
+
+  CAN.setIntPin(2);                             // read over SPI only when a frame is waiting
+  CAN1.setIntPin(3);
+  gateway.begin(routes, sizeof(routes) / sizeof(routes[0]));
+}
+
+void loop()
+{
+  static unsigned long last;
+
+  gateway.service();                            // never blocks
+
+  if(millis() - last >= 5000)
+  {
+    last = millis();
+    for(int i = 0; i < 3; i++)
+    {
+      Serial.print("route ");
+      Serial.print(i);
+      Serial.print(": forwarded ");
+      Serial.print(routes[i].forwarded);
+      Serial.print(", dropped ");
+      Serial.println(routes[i].dropped);
+    }
+  }
+}
+
+/*********************************************************************************************************
+  END FILE
+*********************************************************************************************************/
@@ -0,0 +1,38 @@
+// demo: exchange messages of up to 4095 bytes with an ISO-TP peer, e.g. a diagnostics tester
+// we send on 0x7E8 and receive on 0x7E0
+#include <mcp_can.h>
+#include <can_isotp.h>
+#include <SPI.h>
+
+CANIsoTP isotp(&CAN, 0x7E8, 0x7E0, 0);
+unsigned char rx_buffer[512];
+unsigned char tx_buffer[512];
+
+void setup()
+{
+  Serial.begin(115200);
+  if(CAN.begin(CAN_500KBPS) == CAN_OK) Serial.print("can init ok!!\r\n");
+  else Serial.print("Can init fail!!\r\n");
+
+  isotp.begin(rx_buffer, sizeof(rx_buffer));   // no block size or separation time asked of the peer
+}
+
+void loop()
+{
+  isotp.service(4);                             // never blocks; call as often as possible
+
+  uint16_t len = isotp.available();
+  if(len > 0 && isotp.getTxStatus() != CAN_ISOTP_BUSY)
+  {
+    Serial.print("received ");
+    Serial.print(len);
+    Serial.println(" bytes, echoing");
+    memcpy(tx_buffer, rx_buffer, len);          // tx_buffer must stay untouched while sending
+    isotp.release();
+    isotp.send(tx_buffer, len);
+  }
+}
+
+/*********************************************************************************************************
+  END FILE
+*********************************************************************************************************/
@@ -0,0 +1,59 @@
+// demo: handle emergency stop frames promptly however busy the bus is with slow-to-process logging traffic
+#include <mcp_can.h>
+#include <can_lanes.h>
+#include <SPI.h>
+
+#define ESTOP_ID 0x010
+
+CANFramePool lanePool;                          // so logging can't use up the frames estop needs
+CANFrameQueue estopQueue(&lanePool, 2);
+CANFrameQueue logQueue(&lanePool, 12);
+
+void onEstop(CANFrame *frame)
+{
+  digitalWrite(LED_BUILTIN, frame->data[0] ? HIGH : LOW);
+}
+
+void onLog(CANFrame *frame)
+{
+  Serial.print(frame->stamp);                   // micros() when it was read
+  Serial.print(" ");
+  Serial.print(frame->id, HEX);
+  for(int i = 0; i < frame->len; i++)
+  {
+    Serial.print(" ");
+    Serial.print(frame->data[i], HEX);
+  }
+  Serial.println();                             // milliseconds at 115200 baud
+}
+
+// most urgent first
+CANLane laneTable[] = {
+  {CAN_LANE_RXB0, &estopQueue, onEstop},        // RXF0 and RXF1
+  {CAN_LANE_RXB1, &logQueue, onLog},            // everything else
+};
+CANReceiveLanes lanes(&CAN, &lanePool);
+
+void setup()
+{
+  Serial.begin(115200);
+  pinMode(LED_BUILTIN, OUTPUT);
+  if(CAN.begin(CAN_500KBPS) == CAN_OK) Serial.print("can init ok!!\r\n");
+  else Serial.print("Can init fail!!\r\n");
+
+  CAN.init_Mask(0, 0, 0x7FF);                   // RXB0: the estop ID only
+  CAN.init_Filt(0, 0, ESTOP_ID);
+  CAN.init_Filt(1, 0, ESTOP_ID);
+  CAN.init_Mask(1, 0, 0);                       // RXB1: anything
+
+  lanes.begin(laneTable, sizeof(laneTable) / sizeof(laneTable[0]));
+}
+
+void loop()
+{
+  lanes.service(1);                             // an estop waits for one onLog() at most
+}
+
+/*********************************************************************************************************
+  END FILE
+*********************************************************************************************************/
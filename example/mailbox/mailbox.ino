@@ -0,0 +1,58 @@
+// demo: keep the latest engine speed and coolant temperature, read from the /INT handler
+// /INT on pin 2
+#include <mcp_can.h>
+#include <can_mailbox.h>
+#include <SPI.h>
+
+#define ENGINE_SPEED 0                          // indexes into boxes[]
+#define COOLANT      1
+
+// sorted by format, then ID
+CANMailbox boxes[] = {
+  CAN_MAILBOX(0x0C0, 0),                        // rpm, two bytes big endian
+  CAN_MAILBOX(0x1A0, 0),                        // coolant temperature, degrees C + 40
+};
+CANMailboxes mailboxes(&CAN);
+
+void MCP2515_ISR()
+{
+  mailboxes.service(255);                       // until /INT goes high, or the next edge is lost
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  if(CAN.begin(CAN_500KBPS) == CAN_OK) Serial.print("can init ok!!\r\n");
+  else Serial.print("Can init fail!!\r\n");
+
+  mailboxes.begin(boxes, sizeof(boxes) / sizeof(boxes[0]));
+  CAN.usingInterrupt(digitalPinToInterrupt(2)); // the handler below uses SPI
+  attachInterrupt(digitalPinToInterrupt(2), MCP2515_ISR, FALLING);
+}
+
+void loop()
+{
+  static uint8_t seen[2];
+  unsigned char len, buf[8];
+
+  uint8_t seq = mailboxes.read(ENGINE_SPEED, &len, buf);
+  if(seq != seen[ENGINE_SPEED] && len >= 2)
+  {
+    seen[ENGINE_SPEED] = seq;
+    Serial.print("rpm ");
+    Serial.println((buf[0] << 8) | buf[1]);
+  }
+
+  if(mailboxes.sequence(COOLANT) != seen[COOLANT])
+  {
+    seen[COOLANT] = mailboxes.read(COOLANT, &len, buf);
+    Serial.print("coolant ");
+    Serial.println(buf[0] - 40);
+  }
+
+  delay(100);                                   // however slow this is, values never go stale
+}
+
+/*********************************************************************************************************
+  END FILE
+*********************************************************************************************************/
@@ -0,0 +1,50 @@
+// demo: decode engine data and send a dashboard frame, with the layouts declared once
+#include <mcp_can.h>
+#include <can_signal.h>
+#include <SPI.h>
+
+// name, type, start bit, length, byte order, signedness, scale, offset
+#define ENGINE_SIGNALS(S) \
+  S(rpm,      float,    24, 16, CAN_SIGNAL_INTEL,    unsigned, 0.25, 0) \
+  S(coolant,  int16_t,  16, 8,  CAN_SIGNAL_INTEL,    unsigned, 1,    -40) \
+  S(torque,   int16_t,  7,  10, CAN_SIGNAL_MOTOROLA, signed,   2,    0)
+CAN_MESSAGE(Engine, 0x0C0, 0, 8, ENGINE_SIGNALS)
+
+#define DASH_SIGNALS(S) \
+  S(warning,  uint8_t,  0,  1,  CAN_SIGNAL_INTEL,    unsigned, 1,    0) \
+  S(gauge,    uint8_t,  1,  7,  CAN_SIGNAL_INTEL,    unsigned, 1,    0) \
+  S(speed,    float,    8,  12, CAN_SIGNAL_INTEL,    unsigned, 0.1,  0)
+CAN_MESSAGE(Dash, 0x3F0, 0, 3, DASH_SIGNALS)
+
+void setup()
+{
+  Serial.begin(115200);
+  if(CAN.begin(CAN_500KBPS) == CAN_OK) Serial.print("can init ok!!\r\n");
+  else Serial.print("Can init fail!!\r\n");
+}
+
+void loop()
+{
+  unsigned char len, buf[8];
+
+  if(CAN.checkReceive() != CAN_MSGAVAIL) return;
+  CAN.readMsgBuf(&len, buf);
+  if(CAN.getCanId() != Engine_ID || len < Engine_DLC) return;
+
+  Engine engine;
+  Engine_decode(buf, &engine);
+  Serial.print("rpm ");
+  Serial.print((int)engine.rpm);
+  Serial.print(" coolant ");
+  Serial.println(engine.coolant);
+
+  Dash dash;
+  dash.warning = engine.coolant > 110;
+  dash.gauge = engine.rpm / 8000 * 127;
+  dash.speed = 42.5;
+  Dash_send(&CAN, &dash);
+}
+
+/*********************************************************************************************************
+  END FILE
+*********************************************************************************************************/
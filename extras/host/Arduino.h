@@ -0,0 +1,120 @@
+/*
+  Arduino.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  Host (Linux) stand-in for the parts of the Arduino core used by this
+  library, so the real driver and protocol code can run against simulated
+  MCP2515 controllers. Time is virtual: it only moves when the code under
+  test does something that would take time on an AVR, or calls delay().
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define DEC 10
+#define HEX 16
+
+#define HOST_PINS 256
+#define digitalPinToInterrupt(pin) (pin)
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t interrupt);
+void noInterrupts(void);
+void interrupts(void);
+
+class Print {
+public:
+    virtual size_t write(uint8_t c) = 0;
+    size_t print(const char *s);
+    size_t print(char c);
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(int value, int base = DEC) { return this->print((long)value, base); }
+    size_t print(unsigned int value, int base = DEC) { return this->print((unsigned long)value, base); }
+    size_t println(void);
+    size_t println(const char *s);
+    size_t println(long value, int base = DEC);
+};
+
+class HardwareSerial : public Print {
+public:
+    void begin(unsigned long baud);
+    size_t write(uint8_t c);
+};
+extern HardwareSerial Serial;
+
+// Simulation control. Peripherals on the virtual SPI bus implement
+// HostSPIDevice and are selected by driving their chip select pin low.
+class HostSPIDevice {
+public:
+    virtual ~HostSPIDevice() {}
+    virtual uint8_t csPin() = 0;
+    virtual void select(bool selected) = 0;
+    virtual uint8_t transfer(uint8_t value) = 0;
+};
+
+typedef void (*HostTickHandler)(uint64_t now);
+
+// Each simulated microcontroller has its own clock, pins, interrupts and SPI
+// peripherals. Everything above acts on the selected one; a default MCU is
+// selected at startup, so single-node programs never need these.
+struct HostMCU;
+HostMCU *hostCreateMCU(void);
+HostMCU *hostSelectMCU(HostMCU *mcu);
+HostMCU *hostCurrentMCU(void);
+
+uint64_t hostNanos(void);
+void hostAdvance(uint64_t ns);
+void hostSetTickHandler(HostTickHandler handler);
+void hostAttachSPIDevice(HostSPIDevice *device);
+HostSPIDevice *hostSelectedSPIDevice(void);
+void hostSetPinLevel(uint8_t pin, uint8_t level);
+void hostSetVerbose(bool verbose);
+
+// Virtual cost of each core operation, roughly what it takes on a 16MHz AVR
+#define HOST_F_CPU 16000000UL
+#define HOST_DIGITALIO_NS 3000
+#define HOST_TIMER_READ_NS 1000
+
+#endif
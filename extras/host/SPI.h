@@ -0,0 +1,68 @@
+/*
+  SPI.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  Host stand-in for the Arduino SPI library. Each transfer is routed to the
+  simulated device whose chip select is low and costs one byte time at the
+  current clock.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _HOST_SPI_H_
+#define _HOST_SPI_H_
+
+#include "Arduino.h"
+
+#define MSBFIRST 1
+#define LSBFIRST 0
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+// Per-byte loop overhead on top of the 8 clock periods
+#define HOST_SPI_BYTE_OVERHEAD_NS 500
+
+class SPISettings {
+public:
+    uint32_t clock;
+    uint8_t bitOrder;
+    uint8_t dataMode;
+
+    SPISettings() : clock(4000000), bitOrder(MSBFIRST), dataMode(SPI_MODE0) {}
+    SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) : clock(clock), bitOrder(bitOrder), dataMode(dataMode) {}
+};
+
+class SPIClass {
+private:
+    SPISettings settings;
+    uint8_t nesting;
+
+public:
+    SPIClass() : nesting(0) {}
+    void begin(void);
+    void end(void);
+    void beginTransaction(SPISettings settings);
+    void endTransaction(void);
+    void usingInterrupt(uint8_t interrupt);
+    uint8_t transfer(uint8_t value);
+    uint32_t getClock(void) { return this->settings.clock; }
+    uint8_t inTransaction(void) { return this->nesting; }
+};
+
+extern SPIClass SPI;
+
+#endif
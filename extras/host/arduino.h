@@ -0,0 +1,2 @@
+// mcp_can_dfs.h includes the core header in lower case
+#include "Arduino.h"
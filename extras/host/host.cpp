@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <vector>
+#include "Arduino.h"
+#include "SPI.h"
+
+HardwareSerial Serial;
+SPIClass SPI;
+
+static HostTickHandler tick_handler = NULL;
+static bool verbose = false;
+
+// Everything that belongs to one simulated microcontroller
+struct HostMCU {
+	uint64_t now_ns;
+	bool in_tick;
+	uint8_t pin_level[HOST_PINS];
+	void (*pin_isr[HOST_PINS])(void);
+	int pin_isr_mode[HOST_PINS];
+	bool pin_isr_pending[HOST_PINS];
+	bool interrupts_enabled;
+	bool in_isr;
+	std::vector<HostSPIDevice *> spi_devices;
+
+	HostMCU() : now_ns(0), in_tick(false), interrupts_enabled(true), in_isr(false) {
+		for(int i = 0; i < HOST_PINS; i++) {
+			pin_level[i] = HIGH;
+			pin_isr[i] = NULL;
+			pin_isr_mode[i] = 0;
+			pin_isr_pending[i] = false;
+		}
+	}
+};
+
+static HostMCU *defaultMCU() {
+	static HostMCU mcu;
+	return &mcu;
+}
+
+static HostMCU *mcu = defaultMCU();
+
+static void runPendingISRs() {
+	if(!mcu->interrupts_enabled || mcu->in_isr)
+		return;
+	for(int pin = 0; pin < HOST_PINS; pin++) {
+		if(!mcu->pin_isr_pending[pin])
+			continue;
+		mcu->pin_isr_pending[pin] = false;
+		if(mcu->pin_isr[pin] == NULL)
+			continue;
+		// The core disables interrupts while an ISR runs
+		mcu->in_isr = true;
+		mcu->interrupts_enabled = false;
+		mcu->pin_isr[pin]();
+		mcu->interrupts_enabled = true;
+		mcu->in_isr = false;
+	}
+}
+
+HostMCU *hostCreateMCU(void) {
+	return new HostMCU();
+}
+
+HostMCU *hostSelectMCU(HostMCU *next) {
+	HostMCU *previous = mcu;
+	mcu = next ? next : defaultMCU();
+	return previous;
+}
+
+HostMCU *hostCurrentMCU(void) {
+	return mcu;
+}
+
+uint64_t hostNanos(void) {
+	return mcu->now_ns;
+}
+
+// Moves virtual time forward, giving the simulation a chance to deliver bus
+// events that fall due, then runs any interrupt handlers they triggered.
+void hostAdvance(uint64_t ns) {
+	mcu->now_ns += ns;
+	if(tick_handler != NULL && !mcu->in_tick) {
+		HostMCU *self = mcu;
+		self->in_tick = true;
+		tick_handler(self->now_ns);
+		self->in_tick = false;
+	}
+	runPendingISRs();
+}
+
+void hostSetTickHandler(HostTickHandler handler) {
+	tick_handler = handler;
+}
+
+void hostAttachSPIDevice(HostSPIDevice *device) {
+	mcu->spi_devices.push_back(device);
+}
+
+HostSPIDevice *hostSelectedSPIDevice(void) {
+	for(size_t i = 0; i < mcu->spi_devices.size(); i++) {
+		if(mcu->pin_level[mcu->spi_devices[i]->csPin()] == LOW)
+			return mcu->spi_devices[i];
+	}
+	return NULL;
+}
+
+void hostSetPinLevel(uint8_t pin, uint8_t level) {
+	uint8_t old = mcu->pin_level[pin];
+	mcu->pin_level[pin] = level;
+	if(mcu->pin_isr[pin] == NULL)
+		return;
+
+	int mode = mcu->pin_isr_mode[pin];
+	if((mode == FALLING && old == HIGH && level == LOW) ||
+	   (mode == RISING && old == LOW && level == HIGH) ||
+	   (mode == CHANGE && old != level) ||
+	   (mode == LOW && level == LOW))
+		mcu->pin_isr_pending[pin] = true;
+}
+
+void hostSetVerbose(bool enable) {
+	verbose = enable;
+}
+
+unsigned long millis(void) {
+	hostAdvance(HOST_TIMER_READ_NS);
+	return (unsigned long)(mcu->now_ns / 1000000);
+}
+
+unsigned long micros(void) {
+	hostAdvance(HOST_TIMER_READ_NS);
+	return (unsigned long)(mcu->now_ns / 1000);
+}
+
+void delay(unsigned long ms) {
+	hostAdvance((uint64_t)ms * 1000000);
+}
+
+void delayMicroseconds(unsigned int us) {
+	hostAdvance((uint64_t)us * 1000);
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+	hostAdvance(HOST_DIGITALIO_NS);
+	if(mcu->pin_level[pin] == value)
+		return;
+	mcu->pin_level[pin] = value;
+	for(size_t i = 0; i < mcu->spi_devices.size(); i++) {
+		if(mcu->spi_devices[i]->csPin() == pin)
+			mcu->spi_devices[i]->select(value == LOW);
+	}
+}
+
+int digitalRead(uint8_t pin) {
+	hostAdvance(HOST_DIGITALIO_NS);
+	return mcu->pin_level[pin];
+}
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode) {
+	mcu->pin_isr[interrupt] = isr;
+	mcu->pin_isr_mode[interrupt] = mode;
+	mcu->pin_isr_pending[interrupt] = (mode == LOW && mcu->pin_level[interrupt] == LOW);
+	runPendingISRs();
+}
+
+void detachInterrupt(uint8_t interrupt) {
+	mcu->pin_isr[interrupt] = NULL;
+	mcu->pin_isr_pending[interrupt] = false;
+}
+
+void noInterrupts(void) {
+	mcu->interrupts_enabled = false;
+}
+
+void interrupts(void) {
+	if(mcu->in_isr)
+		return;
+	mcu->interrupts_enabled = true;
+	runPendingISRs();
+}
+
+size_t Print::print(const char *s) {
+	size_t n = 0;
+	while(*s)
+		n += this->write(*s++);
+	return n;
+}
+
+size_t Print::print(char c) {
+	return this->write(c);
+}
+
+size_t Print::print(long value, int base) {
+	if(value < 0 && base == DEC)
+		return this->write('-') + this->print((unsigned long)-value, base);
+	return this->print((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+	char buf[8 * sizeof(long) + 1];
+	char *p = buf + sizeof(buf) - 1;
+
+	*p = '\0';
+	do {
+		uint8_t digit = value % base;
+		*--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+		value /= base;
+	} while(value);
+	return this->print(p);
+}
+
+size_t Print::println(void) {
+	return this->write('\n');
+}
+
+size_t Print::println(const char *s) {
+	return this->print(s) + this->println();
+}
+
+size_t Print::println(long value, int base) {
+	return this->print(value, base) + this->println();
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	if(verbose)
+		fputc(c, stderr);
+	return 1;
+}
+
+void SPIClass::begin(void) {
+}
+
+void SPIClass::end(void) {
+}
+
+// Like the AVR core, runs at the fastest F_CPU / 2^n not above the request
+void SPIClass::beginTransaction(SPISettings settings) {
+	uint32_t clock = HOST_F_CPU / 2;
+	while(clock > settings.clock && clock > HOST_F_CPU / 128)
+		clock /= 2;
+	settings.clock = clock;
+	this->settings = settings;
+	this->nesting++;
+}
+
+void SPIClass::endTransaction(void) {
+	if(this->nesting > 0)
+		this->nesting--;
+}
+
+void SPIClass::usingInterrupt(uint8_t interrupt) {
+}
+
+uint8_t SPIClass::transfer(uint8_t value) {
+	hostAdvance(8000000000ULL / this->settings.clock + HOST_SPI_BYTE_OVERHEAD_NS);
+	HostSPIDevice *device = hostSelectedSPIDevice();
+	return device ? device->transfer(value) : 0xFF;
+}
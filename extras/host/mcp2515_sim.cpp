@@ -0,0 +1,407 @@
+#include "mcp2515_sim.h"
+#include "mcp_can_dfs.h"
+
+#define SIM_RXB_CTRL(n) ((n) ? MCP_RXB1CTRL : MCP_RXB0CTRL)
+#define SIM_TXB_CTRL(n) (MCP_TXB0CTRL + 0x10 * (n))
+
+MCP2515Sim::MCP2515Sim(uint8_t cs_pin, uint8_t int_pin) {
+	this->cs = cs_pin;
+	this->int_pin = int_pin;
+	this->int_level = HIGH;
+	this->selected = false;
+	memset(&this->stats, 0, sizeof(this->stats));
+	this->mcu = hostCurrentMCU();
+	this->reset();
+	hostAttachSPIDevice(this);
+}
+
+void MCP2515Sim::reset() {
+	memset(this->regs, 0, sizeof(this->regs));
+	this->regs[MCP_CANCTRL] = MODE_CONFIG | CLKOUT_ENABLE | CLKOUT_PS8;
+	this->regs[MCP_CANSTAT] = MODE_CONFIG;
+	this->rx_arrival[0] = this->rx_arrival[1] = 0;
+	this->updateInterrupt();
+}
+
+uint8_t MCP2515Sim::csPin() {
+	return this->cs;
+}
+
+uint8_t MCP2515Sim::mode() {
+	return this->regs[MCP_CANSTAT] & MODE_MASK;
+}
+
+void MCP2515Sim::setMode(uint8_t mode) {
+	this->regs[MCP_CANCTRL] = (this->regs[MCP_CANCTRL] & ~MODE_MASK) | mode;
+	this->regs[MCP_CANSTAT] = (this->regs[MCP_CANSTAT] & ~MODE_MASK) | mode;
+}
+
+void MCP2515Sim::updateInterrupt() {
+	uint8_t level = (this->regs[MCP_CANINTE] & this->regs[MCP_CANINTF]) ? LOW : HIGH;
+	if(level == this->int_level)
+		return;
+	this->int_level = level;
+	if(this->int_pin != MCP_NO_INT_PIN) {
+		// The bus delivers frames outside the owning MCU's context
+		HostMCU *previous = hostSelectMCU(this->mcu);
+		hostSetPinLevel(this->int_pin, level);
+		hostSelectMCU(previous);
+	}
+}
+
+void MCP2515Sim::clearRxFlags(uint8_t flags) {
+	for(uint8_t n = 0; n < 2; n++) {
+		uint8_t flag = MCP_RX0IF << n;
+		if((flags & flag) && (this->regs[MCP_CANINTF] & flag)) {
+			uint64_t latency = hostNanos() - this->rx_arrival[n];
+			this->stats.read_latency_count++;
+			this->stats.read_latency_total += latency;
+			if(latency > this->stats.read_latency_max)
+				this->stats.read_latency_max = latency;
+		}
+	}
+	this->regs[MCP_CANINTF] &= ~flags;
+	this->updateInterrupt();
+}
+
+uint8_t MCP2515Sim::readRegister(uint8_t address) {
+	return this->regs[address & 0x7F];
+}
+
+void MCP2515Sim::writeRegister(uint8_t address, uint8_t value) {
+	address &= 0x7F;
+	bool config = this->mode() == MODE_CONFIG;
+
+	switch(address) {
+	case MCP_CANSTAT:
+		return;
+	case MCP_CANCTRL:
+		this->regs[MCP_CANCTRL] = value;
+		this->setMode(value & MODE_MASK);
+		return;
+	case MCP_CANINTF: {
+		uint8_t old = this->regs[MCP_CANINTF];
+		if((value & ~old & MCP_WAKIF) && this->mode() == MODE_SLEEP)
+			this->setMode(MODE_LISTENONLY);
+		this->clearRxFlags(old & ~value & (MCP_RX0IF | MCP_RX1IF));
+		this->regs[MCP_CANINTF] = value;
+		this->updateInterrupt();
+		return;
+	}
+	case MCP_CANINTE:
+		this->regs[MCP_CANINTE] = value;
+		this->updateInterrupt();
+		return;
+	case MCP_EFLG:
+		this->regs[MCP_EFLG] &= value | ~(MCP_EFLG_RX0OVR | MCP_EFLG_RX1OVR);
+		return;
+	case MCP_TXB0CTRL:
+	case MCP_TXB1CTRL:
+	case MCP_TXB2CTRL:
+		this->regs[address] = (this->regs[address] & ~(MCP_TXB_TXREQ_M | MCP_TXB_TXP10_M)) |
+			(value & (MCP_TXB_TXREQ_M | MCP_TXB_TXP10_M));
+		return;
+	case MCP_RXB0CTRL:
+		this->regs[address] = (this->regs[address] & ~(MCP_RXB_RX_MASK | MCP_RXB_BUKT_MASK)) |
+			(value & (MCP_RXB_RX_MASK | MCP_RXB_BUKT_MASK));
+		return;
+	case MCP_RXB1CTRL:
+		this->regs[address] = (this->regs[address] & ~MCP_RXB_RX_MASK) | (value & MCP_RXB_RX_MASK);
+		return;
+	case MCP_CNF1:
+	case MCP_CNF2:
+	case MCP_CNF3:
+		if(config)
+			this->regs[address] = value;
+		return;
+	}
+
+	// Filters and masks are only writable in configuration mode
+	if(address < MCP_CNF3 && (address & 0x0F) < 0x0C) {
+		if(config)
+			this->regs[address] = value;
+		return;
+	}
+	// Receive buffers are read only
+	if((address > MCP_RXB0CTRL && address < MCP_RXB0CTRL + 14) || (address > MCP_RXB1CTRL && address < MCP_RXB1CTRL + 14))
+		return;
+
+	this->regs[address] = value;
+}
+
+void MCP2515Sim::modifyRegister(uint8_t address, uint8_t mask, uint8_t value) {
+	this->writeRegister(address, (this->regs[address & 0x7F] & ~mask) | (value & mask));
+}
+
+void MCP2515Sim::select(bool selected) {
+	if(selected) {
+		this->count = 0;
+		this->rx_clear = 0;
+	} else if(this->selected) {
+		this->stats.spi_transactions++;
+		if(this->rx_clear)
+			this->clearRxFlags(this->rx_clear);
+	}
+	this->selected = selected;
+}
+
+uint8_t MCP2515Sim::transfer(uint8_t value) {
+	uint8_t ret = 0xFF;
+	uint8_t n = this->count++;
+
+	if(n == 0) {
+		this->instruction = value;
+		if(value == MCP_RESET) {
+			this->reset();
+		} else if((value & 0xF8) == 0x80) {
+			// RTS
+			for(uint8_t i = 0; i < MCP_N_TXBUFFERS; i++) {
+				if(value & (1 << i))
+					this->regs[SIM_TXB_CTRL(i)] |= MCP_TXB_TXREQ_M;
+			}
+		} else if((value & 0xF9) == MCP_READ_RX0) {
+			static const uint8_t starts[4] = {0x61, 0x66, 0x71, 0x76};
+			this->address = starts[(value >> 1) & 3];
+			this->rx_clear = value & 0x04 ? MCP_RX1IF : MCP_RX0IF;
+		} else if((value & 0xF8) == MCP_LOAD_TX0 && (value & 0x07) < 6) {
+			static const uint8_t starts[6] = {0x31, 0x36, 0x41, 0x46, 0x51, 0x56};
+			this->address = starts[value & 0x07];
+		}
+		return ret;
+	}
+
+	switch(this->instruction) {
+	case MCP_READ:
+		if(n == 1)
+			this->address = value;
+		else
+			ret = this->readRegister(this->address++);
+		break;
+	case MCP_WRITE:
+		if(n == 1)
+			this->address = value;
+		else
+			this->writeRegister(this->address++, value);
+		break;
+	case MCP_BITMOD:
+		if(n == 1)
+			this->address = value;
+		else if(n == 2)
+			this->mask = value;
+		else if(n == 3)
+			this->modifyRegister(this->address, this->mask, value);
+		break;
+	case MCP_READ_STATUS: {
+		uint8_t intf = this->regs[MCP_CANINTF];
+		ret = (intf & (MCP_RX0IF | MCP_RX1IF));
+		for(uint8_t i = 0; i < MCP_N_TXBUFFERS; i++) {
+			if(this->regs[SIM_TXB_CTRL(i)] & MCP_TXB_TXREQ_M)
+				ret |= 0x04 << (2 * i);
+			if(intf & (MCP_TX0IF << i))
+				ret |= 0x08 << (2 * i);
+		}
+		break;
+	}
+	case MCP_RX_STATUS: {
+		uint8_t intf = this->regs[MCP_CANINTF];
+		uint8_t buffer = intf & MCP_RX0IF ? 0 : 1;
+		ret = (intf & MCP_RX0IF ? 0x40 : 0) | (intf & MCP_RX1IF ? 0x80 : 0);
+		if(ret) {
+			uint8_t ctrl = this->regs[SIM_RXB_CTRL(buffer)];
+			if(this->regs[SIM_RXB_CTRL(buffer) + 2] & MCP_RXB_IDE_M)
+				ret |= 0x10;
+			if(ctrl & 0x08)
+				ret |= 0x08;
+			ret |= buffer ? (ctrl & 0x07) : (ctrl & 0x01);
+		}
+		break;
+	}
+	default:
+		if((this->instruction & 0xF9) == MCP_READ_RX0)
+			ret = this->readRegister(this->address++);
+		else if((this->instruction & 0xF8) == MCP_LOAD_TX0)
+			this->writeRegister(this->address++, value);
+		break;
+	}
+	return ret;
+}
+
+uint32_t MCP2515Sim::bitrate() {
+	uint8_t cnf1 = this->regs[MCP_CNF1], cnf2 = this->regs[MCP_CNF2], cnf3 = this->regs[MCP_CNF3];
+	uint32_t brp = (cnf1 & 0x3F) + 1;
+	uint32_t prop = (cnf2 & 0x07) + 1;
+	uint32_t ps1 = ((cnf2 >> 3) & 0x07) + 1;
+	uint32_t ps2 = (cnf2 & BTLMODE) ? (cnf3 & 0x07) + 1 : (ps1 > 2 ? ps1 : 2);
+	return MCP2515_SIM_OSC_HZ / (2 * brp * (1 + prop + ps1 + ps2));
+}
+
+void MCP2515Sim::decode(uint8_t sidh, SimFrame *frame) {
+	uint8_t *r = &this->regs[sidh];
+	frame->ext = (r[1] & MCP_TXB_EXIDE_M) != 0;
+	uint32_t sid = ((uint32_t)r[0] << 3) | (r[1] >> 5);
+	if(frame->ext)
+		frame->id = (sid << 18) | ((uint32_t)(r[1] & 0x03) << 16) | ((uint32_t)r[2] << 8) | r[3];
+	else
+		frame->id = sid;
+	frame->rtr = (r[4] & MCP_RTR_MASK) != 0;
+	frame->len = r[4] & MCP_DLC_MASK;
+	if(frame->len > 8)
+		frame->len = 8;
+	memcpy(frame->data, r + 5, 8);
+}
+
+// Finds the transmit buffer that would win internal arbitration: highest
+// TXP, then highest buffer number.
+bool MCP2515Sim::pendingTransmit(SimFrame *frame, uint8_t *buffer) {
+	uint8_t mode = this->mode();
+	if(mode != MODE_NORMAL && mode != MODE_LOOPBACK)
+		return false;
+
+	int best = -1;
+	for(uint8_t i = 0; i < MCP_N_TXBUFFERS; i++) {
+		uint8_t ctrl = this->regs[SIM_TXB_CTRL(i)];
+		if((ctrl & MCP_TXB_TXREQ_M) &&
+		   (best < 0 || (ctrl & MCP_TXB_TXP10_M) >= (this->regs[SIM_TXB_CTRL(best)] & MCP_TXB_TXP10_M)))
+			best = i;
+	}
+	if(best < 0)
+		return false;
+
+	this->decode(SIM_TXB_CTRL(best) + 1, frame);
+	*buffer = best;
+	return true;
+}
+
+void MCP2515Sim::transmitComplete(uint8_t buffer) {
+	this->regs[SIM_TXB_CTRL(buffer)] &= ~MCP_TXB_TXREQ_M;
+	this->regs[MCP_CANINTF] |= MCP_TX0IF << buffer;
+	this->stats.transmitted++;
+	this->updateInterrupt();
+}
+
+bool MCP2515Sim::filterMatches(uint8_t filter, uint8_t mask, const SimFrame &frame) {
+	uint8_t *f = &this->regs[filter], *m = &this->regs[mask];
+	if(((f[1] & MCP_TXB_EXIDE_M) != 0) != frame.ext)
+		return false;
+
+	uint32_t fsid = ((uint32_t)f[0] << 3) | (f[1] >> 5);
+	uint32_t msid = ((uint32_t)m[0] << 3) | (m[1] >> 5);
+	if(!frame.ext)
+		return ((frame.id ^ fsid) & msid & 0x7FF) == 0;
+
+	uint32_t fid = (fsid << 18) | ((uint32_t)(f[1] & 0x03) << 16) | ((uint32_t)f[2] << 8) | f[3];
+	uint32_t mid = (msid << 18) | ((uint32_t)(m[1] & 0x03) << 16) | ((uint32_t)m[2] << 8) | m[3];
+	return ((frame.id ^ fid) & mid & 0x1FFFFFFF) == 0;
+}
+
+void MCP2515Sim::load(uint8_t buffer, const SimFrame &frame, uint8_t filhit, uint64_t now) {
+	uint8_t ctrl = SIM_RXB_CTRL(buffer);
+	uint8_t *r = &this->regs[ctrl + 1];
+
+	if(frame.ext) {
+		uint32_t sid = frame.id >> 18;
+		r[0] = sid >> 3;
+		r[1] = ((sid & 0x07) << 5) | MCP_RXB_IDE_M | ((frame.id >> 16) & 0x03);
+		r[2] = frame.id >> 8;
+		r[3] = frame.id;
+		r[4] = frame.len | (frame.rtr ? MCP_RTR_MASK : 0);
+	} else {
+		r[0] = frame.id >> 3;
+		r[1] = ((frame.id & 0x07) << 5) | (frame.rtr ? 0x10 : 0);
+		r[2] = 0;
+		r[3] = 0;
+		r[4] = frame.len;
+	}
+	if(!frame.rtr)
+		memcpy(r + 5, frame.data, frame.len > 8 ? 8 : frame.len);
+
+	if(buffer == 0)
+		this->regs[ctrl] = (this->regs[ctrl] & (MCP_RXB_RX_MASK | MCP_RXB_BUKT_MASK)) |
+			(this->regs[ctrl] & MCP_RXB_BUKT_MASK ? 0x02 : 0) | (frame.rtr ? 0x08 : 0) | (filhit & 0x01);
+	else
+		this->regs[ctrl] = (this->regs[ctrl] & MCP_RXB_RX_MASK) | (frame.rtr ? 0x08 : 0) | (filhit & 0x07);
+
+	this->regs[MCP_CANINTF] |= MCP_RX0IF << buffer;
+	this->rx_arrival[buffer] = now;
+	this->stats.received++;
+	this->updateInterrupt();
+}
+
+// A frame seen on the bus, at the end of its EOF field
+void MCP2515Sim::receive(const SimFrame &frame, uint64_t now) {
+	uint8_t mode = this->mode();
+	if(mode == MODE_CONFIG || mode == MODE_LOOPBACK)
+		return;
+	if(mode == MODE_SLEEP) {
+		// Bus activity wakes the controller into listen-only mode; the frame
+		// itself is lost.
+		this->regs[MCP_CANINTF] |= MCP_WAKIF;
+		this->setMode(MODE_LISTENONLY);
+		this->updateInterrupt();
+		return;
+	}
+
+	static const uint8_t rxb1_filters[4] = {MCP_RXF2SIDH, MCP_RXF3SIDH, MCP_RXF4SIDH, MCP_RXF5SIDH};
+	int hit = -1;
+	uint8_t rxm = this->regs[MCP_RXB0CTRL] & MCP_RXB_RX_MASK;
+	if(rxm == MCP_RXB_RX_ANY)
+		hit = 0;
+	else if(this->filterMatches(MCP_RXF0SIDH, MCP_RXM0SIDH, frame))
+		hit = 0;
+	else if(this->filterMatches(MCP_RXF1SIDH, MCP_RXM0SIDH, frame))
+		hit = 1;
+	if(hit >= 0 && !((rxm == MCP_RXB_RX_STD && frame.ext) || (rxm == MCP_RXB_RX_EXT && !frame.ext))) {
+		if(!(this->regs[MCP_CANINTF] & MCP_RX0IF)) {
+			this->load(0, frame, hit, now);
+		} else if(this->regs[MCP_RXB0CTRL] & MCP_RXB_BUKT_MASK) {
+			if(!(this->regs[MCP_CANINTF] & MCP_RX1IF)) {
+				this->load(1, frame, hit, now);
+			} else {
+				this->regs[MCP_EFLG] |= MCP_EFLG_RX1OVR;
+				this->regs[MCP_CANINTF] |= MCP_ERRIF;
+				this->stats.overruns++;
+			}
+		} else {
+			this->regs[MCP_EFLG] |= MCP_EFLG_RX0OVR;
+			this->regs[MCP_CANINTF] |= MCP_ERRIF;
+			this->stats.overruns++;
+		}
+		this->updateInterrupt();
+		return;
+	}
+
+	hit = -1;
+	rxm = this->regs[MCP_RXB1CTRL] & MCP_RXB_RX_MASK;
+	if(rxm == MCP_RXB_RX_ANY) {
+		hit = 2;
+	} else {
+		for(uint8_t i = 0; i < 4 && hit < 0; i++) {
+			if(this->filterMatches(rxb1_filters[i], MCP_RXM1SIDH, frame))
+				hit = i + 2;
+		}
+	}
+	if(hit < 0 || (rxm == MCP_RXB_RX_STD && frame.ext) || (rxm == MCP_RXB_RX_EXT && !frame.ext))
+		return;
+	if(!(this->regs[MCP_CANINTF] & MCP_RX1IF)) {
+		this->load(1, frame, hit, now);
+	} else {
+		this->regs[MCP_EFLG] |= MCP_EFLG_RX1OVR;
+		this->regs[MCP_CANINTF] |= MCP_ERRIF;
+		this->stats.overruns++;
+	}
+	this->updateInterrupt();
+}
+
+// Something on the bus that this controller could not decode, e.g. because
+// it is configured for a different bit rate
+void MCP2515Sim::busError() {
+	uint8_t mode = this->mode();
+	if(mode == MODE_CONFIG || mode == MODE_LOOPBACK || mode == MODE_SLEEP)
+		return;
+	this->regs[MCP_CANINTF] |= MCP_MERRF;
+	if(mode != MODE_LISTENONLY) {
+		this->regs[MCP_REC] = this->regs[MCP_REC] < 255 ? this->regs[MCP_REC] + 1 : 255;
+		this->regs[MCP_CANINTF] |= MCP_ERRIF;
+	}
+	this->updateInterrupt();
+}
@@ -0,0 +1,98 @@
+/*
+  mcp2515_sim.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  Register-level model of an MCP2515 behind the host SPI stand-in: SPI
+  instruction set, acceptance masks and filters, RXB0 rollover, overflow and
+  interrupt flags, the /INT pin, operating modes and transmit buffer
+  priorities. Bit timing is derived from CNF1-3 assuming a 16MHz crystal.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _MCP2515_SIM_H_
+#define _MCP2515_SIM_H_
+
+#include "Arduino.h"
+
+#define MCP2515_SIM_OSC_HZ 16000000UL
+
+typedef struct {
+  uint32_t id;
+  bool ext;
+  bool rtr;
+  uint8_t len;
+  uint8_t data[8];
+} SimFrame;
+
+typedef struct {
+  uint32_t received;                // frames accepted into a receive buffer
+  uint32_t overruns;                // accepted frames lost because the buffers were full
+  uint32_t transmitted;
+  uint32_t spi_transactions;
+  uint32_t read_latency_count;      // time from end of frame to RXnIF being cleared
+  uint64_t read_latency_total;
+  uint64_t read_latency_max;
+} SimStats;
+
+class MCP2515Sim : public HostSPIDevice {
+private:
+    uint8_t regs[128];
+    uint8_t cs;
+    uint8_t int_pin;
+    uint8_t int_level;
+    HostMCU *mcu;                     // the microcontroller wired to this chip
+
+    // SPI transaction state
+    bool selected;
+    uint8_t instruction;
+    uint8_t address;
+    uint8_t mask;
+    uint8_t count;
+    uint8_t rx_clear;
+
+    uint64_t rx_arrival[2];
+
+    void reset();
+    uint8_t readRegister(uint8_t address);
+    void writeRegister(uint8_t address, uint8_t value);
+    void modifyRegister(uint8_t address, uint8_t mask, uint8_t value);
+    void setMode(uint8_t mode);
+    void updateInterrupt();
+    void clearRxFlags(uint8_t flags);
+    bool filterMatches(uint8_t filter, uint8_t mask, const SimFrame &frame);
+    void load(uint8_t buffer, const SimFrame &frame, uint8_t filhit, uint64_t now);
+    void decode(uint8_t sidh, SimFrame *frame);
+
+public:
+    SimStats stats;
+
+    MCP2515Sim(uint8_t cs_pin, uint8_t int_pin);
+
+    // HostSPIDevice
+    uint8_t csPin();
+    void select(bool selected);
+    uint8_t transfer(uint8_t value);
+
+    // Bus side
+    uint8_t mode();
+    uint32_t bitrate();
+    bool pendingTransmit(SimFrame *frame, uint8_t *buffer);
+    void transmitComplete(uint8_t buffer);
+    void receive(const SimFrame &frame, uint64_t now);
+    void busError();
+};
+
+#endif
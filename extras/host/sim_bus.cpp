@@ -0,0 +1,138 @@
+#include "sim_bus.h"
+
+// On-wire length in bits, including worst-case stuffing and the 3-bit
+// intermission that separates it from the next frame
+uint32_t simFrameBits(const SimFrame &frame) {
+	uint32_t data = frame.rtr ? 0 : 8 * frame.len;
+	if(frame.ext)
+		return 67 + data + (54 + data - 1) / 4;
+	return 47 + data + (34 + data - 1) / 4;
+}
+
+SimBus::SimBus(uint32_t bitrate) {
+	this->rate = bitrate;
+	this->busy = false;
+	this->busy_until = 0;
+	this->observer = NULL;
+	this->busy_ns = 0;
+	this->frames = 0;
+	this->external_backlog_max = 0;
+}
+
+uint32_t SimBus::bitrate() {
+	return this->rate;
+}
+
+void SimBus::attach(MCP2515Sim *chip) {
+	this->chips.push_back(chip);
+}
+
+// Queues a frame from an external node, ready to transmit at time at (ns).
+// Frames must be injected in time order.
+void SimBus::inject(const SimFrame &frame, uint64_t at) {
+	this->external.push_back(std::make_pair(at, frame));
+}
+
+size_t SimBus::backlog() {
+	return this->external.size();
+}
+
+void SimBus::setObserver(SimFrameObserver observer) {
+	this->observer = observer;
+}
+
+bool SimBus::idle() {
+	return !this->busy && this->external.empty();
+}
+
+// Earliest time anything external will happen on the bus
+uint64_t SimBus::nextEvent() {
+	if(this->busy)
+		return this->busy_until;
+	if(!this->external.empty())
+		return this->external.front().first;
+	return UINT64_MAX;
+}
+
+// Standard identifiers win over extended ones with the same base ID, and
+// data frames over remote frames.
+uint64_t SimBus::arbitrationKey(const SimFrame &frame) {
+	uint64_t key;
+	if(frame.ext)
+		key = ((uint64_t)(frame.id >> 18) << 32) | (1ULL << 31) | ((uint64_t)(frame.id & 0x3FFFF) << 1);
+	else
+		key = (uint64_t)frame.id << 32;
+	return key | (frame.rtr ? 1 : 0);
+}
+
+void SimBus::run(uint64_t now) {
+	for(;;) {
+		if(this->busy) {
+			if(this->busy_until > now)
+				return;
+
+			// End of frame: everyone else at our bit rate receives it
+			this->busy = false;
+			for(size_t i = 0; i < this->chips.size(); i++) {
+				if((int)i == this->current_sender)
+					continue;
+				if(this->chips[i]->bitrate() == this->rate)
+					this->chips[i]->receive(this->current, this->busy_until);
+				else
+					this->chips[i]->busError();
+			}
+			if(this->current_sender >= 0)
+				this->chips[this->current_sender]->transmitComplete(this->current_buffer);
+		}
+
+		// Arbitrate between everything ready to go
+		uint64_t start = this->busy_until > now ? this->busy_until : now;
+		int winner = -2;
+		uint8_t winner_buffer = 0;
+		SimFrame frame, best;
+		uint64_t best_key = UINT64_MAX;
+
+		if(!this->external.empty() && this->external.front().first <= now) {
+			start = this->external.front().first > this->busy_until ? this->external.front().first : this->busy_until;
+			best = this->external.front().second;
+			best_key = this->arbitrationKey(best);
+			winner = -1;
+		}
+		for(size_t i = 0; i < this->chips.size(); i++) {
+			uint8_t buffer;
+			if(this->chips[i]->bitrate() != this->rate || !this->chips[i]->pendingTransmit(&frame, &buffer))
+				continue;
+			uint64_t key = this->arbitrationKey(frame);
+			if(key < best_key) {
+				best = frame;
+				best_key = key;
+				winner = i;
+				winner_buffer = buffer;
+				start = this->busy_until > now ? this->busy_until : now;
+			}
+		}
+		if(winner == -2)
+			return;
+
+		if(winner == -1) {
+			this->external.pop_front();
+		}
+		// Backlog is what was already due when this frame went out
+		uint32_t waiting = 0;
+		while(waiting < this->external.size() && this->external[waiting].first <= start)
+			waiting++;
+		if(waiting > this->external_backlog_max)
+			this->external_backlog_max = waiting;
+
+		uint64_t duration = (uint64_t)simFrameBits(best) * 1000000000ULL / this->rate;
+		this->busy = true;
+		this->busy_until = start + duration;
+		this->current = best;
+		this->current_sender = winner;
+		this->current_buffer = winner_buffer;
+		this->busy_ns += duration;
+		this->frames++;
+		if(this->observer)
+			this->observer(best, winner, start, this->busy_until);
+	}
+}
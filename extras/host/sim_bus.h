@@ -0,0 +1,67 @@
+/*
+  sim_bus.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  A virtual CAN bus connecting simulated MCP2515s and external frame
+  sources. Frames occupy the bus for their full on-wire duration, pending
+  transmissions arbitrate by identifier when the bus goes idle, and every
+  controller at the bus bit rate sees every frame it did not send.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _SIM_BUS_H_
+#define _SIM_BUS_H_
+
+#include <deque>
+#include <vector>
+#include "mcp2515_sim.h"
+
+typedef void (*SimFrameObserver)(const SimFrame &frame, int sender, uint64_t start, uint64_t end);
+
+class SimBus {
+private:
+    uint32_t rate;
+    std::vector<MCP2515Sim *> chips;
+    std::deque<std::pair<uint64_t, SimFrame> > external;
+
+    bool busy;
+    uint64_t busy_until;
+    SimFrame current;
+    int current_sender;
+    uint8_t current_buffer;
+    SimFrameObserver observer;
+
+    uint64_t arbitrationKey(const SimFrame &frame);
+
+public:
+    uint64_t busy_ns;
+    uint32_t frames;
+    uint32_t external_backlog_max;
+
+    SimBus(uint32_t bitrate);
+    uint32_t bitrate();
+    void attach(MCP2515Sim *chip);
+    void inject(const SimFrame &frame, uint64_t at);
+    size_t backlog();
+    void setObserver(SimFrameObserver observer);
+    bool idle();
+    uint64_t nextEvent();
+    void run(uint64_t now);
+};
+
+uint32_t simFrameBits(const SimFrame &frame);
+
+#endif
@@ -0,0 +1,500 @@
+/*
+  netsim.cpp
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  Discrete-event simulation of a whole uCAN network: every node is a real
+  uCAN_IMPL, MCP_CAN and simulated MCP2515 on its own virtual
+  microcontroller, sharing one bus that models bit rate, arbitration and
+  frame length. Nodes are cooperative coroutines; the scheduler always runs
+  the node furthest behind in virtual time for at most one quantum, so
+  node clocks never drift further apart than that.
+
+  One master and N slaves power up at staggered times and negotiate node
+  IDs with begin(). The master then looks every slave up by hardware ID
+  and runs polling cycles of unicast reads, fan-out polls and broadcast
+  polls. The report covers startup times, ID conflicts, bus utilisation
+  per phase and request latency distributions.
+
+  Build from the library root:
+    g++ -O2 -Iextras/host -I. -o netsim extras/netsim/netsim.cpp \
+        extras/host/host.cpp extras/host/mcp2515_sim.cpp extras/host/sim_bus.cpp \
+        mcp_can.cpp uCAN.cpp ucan_address.cpp ucan_heartbeat.cpp ucan_clock.cpp \
+        can_pool.cpp
+
+  Usage: netsim [options]
+    -n nodes    number of slaves, 1-126 (default 64)
+    -s ms       power-on stagger between slaves (default 10)
+    -c ids      draw default node IDs from only this many values, so
+                begin() has to resolve conflicts (default 0 = all distinct)
+    -p cycles   polling cycles run by the master (default 10)
+    -t ms       uCAN timeout ceiling (default 1000)
+    -a file     make the master an address server, keeping its table in
+                file; run again with the same file to see a warm restart
+    -q us       scheduling quantum (default 50)
+    -S seed     random seed for power-on jitter (default 1)
+    -T s        give up after this much virtual time (default 600)
+    -v          echo the library's debug output
+
+  Frames are timed from the moment the scheduler runs the bus, which may
+  be up to one quantum after the sender loaded them. A slave with nothing
+  to do sleeps until the next frame on the bus ends, as if its main loop
+  waited on /INT, which keeps idle nodes from dominating the run time.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <ucontext.h>
+#include <algorithm>
+#include <queue>
+#include <vector>
+#include "mcp2515_sim.h"
+#include "sim_bus.h"
+#include "mcp_can.h"
+#include "uCAN.h"
+#include "ucan_address.h"
+
+#define NETSIM_CS_PIN 10
+#define NETSIM_STACK_SIZE (64 * 1024)
+#define NETSIM_MAX_SLAVES 126
+#define NETSIM_PHASES 4
+
+typedef struct {
+  int index;
+  HostMCU *mcu;
+  MCP2515Sim *chip;
+  MCP_CAN *can;
+  CANFramePool *pool;
+  uCAN_IMPL *ucan;
+  HardwareID hardware_id;
+  uint8_t default_node_id;
+  ucontext_t context;
+  char *stack;
+  uint64_t power_on;                // ns
+  uint64_t started;                 // ns, when begin() returned
+  uint64_t wake;                    // ns, while parked; UINT64_MAX until the next frame
+  bool parked;
+  bool finished;
+} Node;
+
+typedef struct {
+  const char *name;
+  uint64_t start;                   // ns
+  uint64_t busy_start;
+  uint32_t frames_start;
+  uint64_t end;
+  uint64_t busy_end;
+  uint32_t frames_end;
+} Phase;
+
+// Time-ordered run queue of (local time, node index)
+typedef std::pair<uint64_t, int> RunEntry;
+
+static SimBus *bus;
+static std::vector<Node *> nodes;
+static Node *current = NULL;
+static ucontext_t scheduler;
+static uint64_t slice_end;
+static uint64_t quantum_ns;
+static std::priority_queue<RunEntry, std::vector<RunEntry>, std::greater<RunEntry> > run_queue;
+static std::vector<int> parked;
+static bool stop = false;
+static int poll_cycles = 10;
+static uint16_t timeout_ms = 1000;
+static uCANAddressServer *address_server = NULL;
+
+static int slaves_started = 0;
+static Phase phases[NETSIM_PHASES];
+static int phase_count = 0;
+static int lookups_failed = 0;
+static int reads_failed = 0;
+static int fanout_missing = 0;
+static int broadcast_missing = 0;
+static std::vector<uint32_t> startup_us, lookup_us, read_us, fanout_us, broadcast_us;
+
+static uint8_t readRegister(NodeAddress address, uint8_t page, uint8_t reg) {
+	return reg;
+}
+
+static void writeRegister(NodeAddress address, uint8_t page, uint8_t reg, uint8_t data) {
+}
+
+static RegisterHandlers handlers[] = {
+	{0, readRegister, writeRegister},
+	{0, NULL, NULL},
+};
+
+// Hands control back to the scheduler once the running node is a quantum
+// ahead of the node that was furthest behind when it was resumed. If it is
+// still the furthest behind, it just carries on without a context switch.
+static void tick(uint64_t now) {
+	if(current == NULL || now < slice_end)
+		return;
+	if(run_queue.empty() || run_queue.top().first > now) {
+		bus->run(now);
+		if(run_queue.empty() || run_queue.top().first > now) {
+			slice_end = now + quantum_ns;
+			return;
+		}
+	}
+	swapcontext(&current->context, &scheduler);
+}
+
+// Wakes every parked node when the frame now starting on the bus ends
+static void frameStarted(const SimFrame &frame, int sender, uint64_t start, uint64_t end) {
+	for(size_t i = 0; i < parked.size(); i++) {
+		nodes[parked[i]]->wake = end;
+		run_queue.push(RunEntry(end, parked[i]));
+	}
+	parked.clear();
+}
+
+// Sleeps the running node until a frame it might have to handle has ended
+static void sleepUntilTraffic(Node *node) {
+	node->parked = true;
+	node->wake = bus->nextEvent();
+	swapcontext(&node->context, &scheduler);
+	node->parked = false;
+
+	uint64_t now = hostNanos();
+	if(node->wake > now)
+		hostAdvance(node->wake - now);
+}
+
+static void beginPhase(const char *name) {
+	Phase *phase = &phases[phase_count++];
+	phase->name = name;
+	phase->start = hostNanos();
+	phase->busy_start = bus->busy_ns;
+	phase->frames_start = bus->frames;
+}
+
+static void endPhase() {
+	Phase *phase = &phases[phase_count - 1];
+	phase->end = hostNanos();
+	phase->busy_end = bus->busy_ns;
+	phase->frames_end = bus->frames;
+}
+
+static void runSlave(Node *node) {
+	node->ucan->configureRegisters(handlers);
+	node->ucan->begin(node->hardware_id, node->default_node_id);
+	node->started = hostNanos();
+	startup_us.push_back((node->started - node->power_on) / 1000);
+	slaves_started++;
+
+	while(!stop) {
+		if(!node->ucan->receive())
+			sleepUntilTraffic(node);
+	}
+}
+
+static void runMaster(Node *node, int slave_count, int cycles) {
+	node->ucan->configureAddressServer(address_server);
+	node->ucan->begin(node->hardware_id, node->default_node_id);
+	node->started = hostNanos();
+
+	beginPhase("startup");
+	while(slaves_started < slave_count)
+		node->ucan->receive();
+	endPhase();
+
+	// Find every slave by hardware ID, as an application would at boot
+	beginPhase("discovery");
+	std::vector<NodeAddress> found;
+	for(int i = 1; i <= slave_count; i++) {
+		uint32_t start = micros();
+		NodeAddress address = node->ucan->getNodeFromHardwareID(nodes[i]->hardware_id);
+		lookup_us.push_back(micros() - start);
+		if(address == UCAN_NODE_NOT_FOUND)
+			lookups_failed++;
+		else
+			found.push_back(address);
+	}
+	endPhase();
+
+	beginPhase("unicast poll");
+	for(int cycle = 0; cycle < cycles; cycle++) {
+		for(size_t i = 0; i < found.size(); i++) {
+			uint8_t data[4];
+			uint32_t start = micros();
+			bool ok = node->ucan->readRegisters(found[i], 0, 0, sizeof(data), data);
+			read_us.push_back(micros() - start);
+			if(!ok)
+				reads_failed++;
+		}
+	}
+	endPhase();
+
+	beginPhase("group poll");
+	std::vector<uint8_t> results(found.size() * 4), status(found.size());
+	uint8_t all[UCAN_MAX_NODES * 4], replied[UCAN_MAX_NODES / 8];
+	for(int cycle = 0; cycle < cycles && !found.empty(); cycle++) {
+		uint32_t start = micros();
+		uint8_t ok = node->ucan->pollRegisters(&found[0], found.size(), 0, 0, 4, &results[0], &status[0]);
+		fanout_us.push_back(micros() - start);
+		fanout_missing += found.size() - ok;
+
+		start = micros();
+		ok = node->ucan->pollRegisters(0, 0, 4, all, replied);
+		broadcast_us.push_back(micros() - start);
+		broadcast_missing += found.size() > ok ? found.size() - ok : 0;
+	}
+	endPhase();
+}
+
+static void nodeMain() {
+	Node *node = current;
+	if(node->index == 0)
+		runMaster(node, nodes.size() - 1, poll_cycles);
+	else
+		runSlave(node);
+	node->finished = true;
+}
+
+static Node *createNode(int index, uint8_t default_node_id, uint64_t power_on) {
+	Node *node = new Node();
+	node->index = index;
+	node->mcu = hostCreateMCU();
+	node->power_on = power_on;
+	node->default_node_id = default_node_id;
+
+	// Devices attach to whichever MCU is selected when they are created
+	hostSelectMCU(node->mcu);
+	hostAdvance(power_on);
+	node->chip = new MCP2515Sim(NETSIM_CS_PIN, MCP_NO_INT_PIN);
+	bus->attach(node->chip);
+	node->can = new MCP_CAN(NETSIM_CS_PIN);
+	node->pool = new CANFramePool();
+	node->ucan = new uCAN_IMPL(node->can, node->pool);
+	node->ucan->setTimeout(timeout_ms);
+	hostSelectMCU(NULL);
+
+	// Locally administered MAC-style hardware ID
+	uint8_t address[6] = {0x02, 0x00, 0x00, 0x00, (uint8_t)(index >> 8), (uint8_t)index};
+	memcpy(node->hardware_id.address, address, sizeof(address));
+
+	node->stack = new char[NETSIM_STACK_SIZE];
+	getcontext(&node->context);
+	node->context.uc_stack.ss_sp = node->stack;
+	node->context.uc_stack.ss_size = NETSIM_STACK_SIZE;
+	node->context.uc_link = &scheduler;
+	makecontext(&node->context, nodeMain, 0);
+	return node;
+}
+
+static uint64_t localTime(Node *node) {
+	HostMCU *previous = hostSelectMCU(node->mcu);
+	uint64_t now = hostNanos();
+	hostSelectMCU(previous);
+	return now;
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, int pct) {
+	if(sorted.empty())
+		return 0;
+	size_t i = (sorted.size() * pct + 99) / 100;
+	return sorted[i > 0 ? i - 1 : 0];
+}
+
+static void printDistribution(const char *name, std::vector<uint32_t> samples) {
+	printf("%s: %zu samples", name, samples.size());
+	if(samples.empty()) {
+		printf("\n");
+		return;
+	}
+	std::sort(samples.begin(), samples.end());
+	uint64_t total = 0;
+	for(size_t i = 0; i < samples.size(); i++)
+		total += samples[i];
+	printf(", us min %u mean %llu p50 %u p90 %u p99 %u max %u\n", samples.front(),
+	       (unsigned long long)(total / samples.size()), percentile(samples, 50),
+	       percentile(samples, 90), percentile(samples, 99), samples.back());
+
+	// Power-of-two histogram
+	size_t buckets[33] = {0};
+	int lo = 32, hi = 0;
+	for(size_t i = 0; i < samples.size(); i++) {
+		int b = 0;
+		while(b < 32 && (1UL << b) <= samples[i])
+			b++;
+		buckets[b]++;
+		lo = b < lo ? b : lo;
+		hi = b > hi ? b : hi;
+	}
+	for(int b = lo; b <= hi; b++) {
+		int width = (int)(buckets[b] * 50 / samples.size());
+		printf("  < %9lu us %6zu %.*s\n", 1UL << b, buckets[b], width,
+		       "##################################################");
+	}
+}
+
+int main(int argc, char **argv) {
+	int slave_count = 64, id_values = 0;
+	uint32_t stagger_ms = 10, quantum_us = 50, limit_s = 600;
+	unsigned seed = 1;
+	int opt;
+
+	while((opt = getopt(argc, argv, "n:s:c:p:t:a:q:S:T:v")) != -1) {
+		switch(opt) {
+		case 'n': slave_count = atoi(optarg); break;
+		case 's': stagger_ms = strtoul(optarg, NULL, 0); break;
+		case 'c': id_values = atoi(optarg); break;
+		case 'p': poll_cycles = atoi(optarg); break;
+		case 't': timeout_ms = strtoul(optarg, NULL, 0); break;
+		case 'a':
+			address_server = new uCANAddressServer(optarg);
+			address_server->load();
+			break;
+		case 'q': quantum_us = strtoul(optarg, NULL, 0); break;
+		case 'S': seed = strtoul(optarg, NULL, 0); break;
+		case 'T': limit_s = strtoul(optarg, NULL, 0); break;
+		case 'v': hostSetVerbose(true); break;
+		default:
+			fprintf(stderr, "usage: %s [-n nodes] [-s ms] [-c ids] [-p cycles] [-t ms] [-a file] [-q us] [-S seed] [-T s] [-v]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(slave_count < 1 || slave_count > NETSIM_MAX_SLAVES || quantum_us == 0) {
+		fprintf(stderr, "%s: need 1-%d slaves and a non-zero quantum\n", argv[0], NETSIM_MAX_SLAVES);
+		return 1;
+	}
+	srand(seed);
+
+	quantum_ns = quantum_us * 1000ULL;
+	bus = new SimBus(125000);
+	hostSetTickHandler(tick);
+
+	// The master takes node ID 0; slave i defaults to i, or to one of only
+	// id_values IDs if conflicts were asked for
+	nodes.push_back(createNode(0, 0, 0));
+	for(int i = 1; i <= slave_count; i++) {
+		uint64_t jitter = stagger_ms ? (uint64_t)(rand() % (stagger_ms * 1000)) * 1000 : 0;
+		uint64_t power_on = (uint64_t)i * stagger_ms * 1000000ULL + jitter;
+		uint8_t default_node_id = id_values > 0 ? 1 + (i - 1) % id_values : i;
+		nodes.push_back(createNode(i, default_node_id, power_on));
+	}
+	for(size_t i = 0; i < nodes.size(); i++)
+		nodes[i]->chip->stats = SimStats();
+
+	bus->setObserver(frameStarted);
+	for(size_t i = 0; i < nodes.size(); i++)
+		run_queue.push(RunEntry(nodes[i]->power_on, i));
+
+	clock_t host_start = clock();
+	uint64_t limit = (uint64_t)limit_s * 1000000000ULL;
+	uint64_t now = 0;
+	while(!run_queue.empty() && !nodes[0]->finished) {
+		RunEntry entry = run_queue.top();
+		run_queue.pop();
+		Node *node = nodes[entry.second];
+		now = entry.first;
+		if(now >= limit)
+			break;
+
+		bus->run(now);
+		slice_end = now + quantum_ns;
+		hostSelectMCU(node->mcu);
+		current = node;
+		swapcontext(&scheduler, &node->context);
+		current = NULL;
+		hostSelectMCU(NULL);
+
+		if(node->finished)
+			continue;
+		if(!node->parked)
+			run_queue.push(RunEntry(localTime(node), entry.second));
+		else if(node->wake != UINT64_MAX)
+			run_queue.push(RunEntry(node->wake, entry.second));
+		else
+			parked.push_back(entry.second);
+	}
+	stop = true;
+	double host_s = (double)(clock() - host_start) / CLOCKS_PER_SEC;
+
+	printf("%d slaves + master, 125 kbit/s, quantum %u us, timeout ceiling %u ms\n",
+	       slave_count, quantum_us, timeout_ms);
+	if(address_server)
+		printf("master is an address server, %d node IDs allocated\n", address_server->getCount());
+	printf("simulated %.3f s in %.1f s host time%s\n", now / 1e9, host_s,
+	       nodes[0]->finished ? "" : " (stopped before the master finished)");
+
+	// Startup and node ID negotiation
+	printf("\nstarted %d of %d slaves", slaves_started, slave_count);
+	uint64_t last_started = 0;
+	for(size_t i = 1; i < nodes.size(); i++)
+		last_started = nodes[i]->started > last_started ? nodes[i]->started : last_started;
+	printf(", last at %.3f s\n", last_started / 1e9);
+	printDistribution("begin() time", startup_us);
+
+	int owners[UCAN_MAX_NODES] = {0};
+	int duplicates = 0, moved = 0;
+	for(size_t i = 0; i < nodes.size(); i++) {
+		if(i > 0 && nodes[i]->started == 0)
+			continue;
+		uint8_t id = nodes[i]->ucan->getNodeID();
+		if(id >= UCAN_MAX_NODES)
+			continue;
+		if(owners[id]++ == 1)
+			duplicates++;
+		if(id != nodes[i]->default_node_id)
+			moved++;
+	}
+	printf("node IDs: %d moved off their default, %d claimed by more than one node\n", moved, duplicates);
+	for(int id = 0; id < UCAN_MAX_NODES; id++) {
+		if(owners[id] > 1)
+			printf("  node ID %d: %d nodes\n", id, owners[id]);
+	}
+
+	// Bus utilisation per phase
+	printf("\nbus: %u frames, %.1f%% busy overall\n", bus->frames, now ? 100.0 * bus->busy_ns / now : 0.0);
+	if(phase_count > 0) {
+		// Everything before the master started waiting counts as startup too
+		phases[0].start = 0;
+		phases[0].busy_start = 0;
+		phases[0].frames_start = 0;
+	}
+	for(int i = 0; i < phase_count; i++) {
+		Phase *phase = &phases[i];
+		uint64_t length = phase->end > phase->start ? phase->end - phase->start : 0;
+		// Frames are counted whole when they start, so clip the overhang
+		uint64_t busy = phase->busy_end - phase->busy_start;
+		busy = busy < length ? busy : length;
+		printf("  %-13s %9.3f s %7u frames %5.1f%% busy\n", phase->name, length / 1e9,
+		       phase->frames_end - phase->frames_start,
+		       length ? 100.0 * busy / length : 0.0);
+	}
+
+	uint32_t overruns = 0;
+	for(size_t i = 0; i < nodes.size(); i++)
+		overruns += nodes[i]->chip->stats.overruns;
+	printf("receive overruns across all nodes: %u\n", overruns);
+
+	// Request latency as the master saw it
+	printf("\n");
+	printDistribution("hardware ID lookup", lookup_us);
+	printf("  %d failed\n", lookups_failed);
+	printDistribution("readRegisters", read_us);
+	printf("  %d failed\n", reads_failed);
+	printDistribution("fan-out poll cycle", fanout_us);
+	printf("  %d replies missing\n", fanout_missing);
+	printDistribution("broadcast poll cycle", broadcast_us);
+	printf("  %d replies missing\n", broadcast_missing);
+	return 0;
+}
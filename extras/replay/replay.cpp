@@ -0,0 +1,279 @@
+/*
+  replay.cpp
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  Replays a recorded CAN capture into a simulated MCP2515 driven by the real
+  MCP_CAN and uCAN_IMPL code, and reports what the receive path lost.
+
+  Build from the library root:
+    g++ -O2 -Iextras/host -I. -o replay extras/replay/replay.cpp \
+        extras/host/host.cpp extras/host/mcp2515_sim.cpp extras/host/sim_bus.cpp \
+        mcp_can.cpp uCAN.cpp ucan_address.cpp ucan_heartbeat.cpp ucan_clock.cpp \
+        can_pool.cpp
+
+  Usage: replay [options] capture
+    -b          capture is binary (see below) rather than a candump -L log
+    -x factor   replay speed relative to the capture (default 1 = real time)
+    -r bitrate  bus bit rate (default 125000, which is what uCAN uses)
+    -u          run the uCAN stack (uCAN.service) rather than a bare driver loop
+    -n node     uCAN node ID to claim (default 1)
+    -i          wire /INT and let the code under test use it
+    -w us       simulated application work per received frame (default 0)
+    -v          echo the library's debug output
+
+  candump -L lines look like "(1436509052.249713) can0 123#DEADBEEF"; IDs
+  with more than 3 hex digits are extended and "#R" marks a remote frame.
+  Binary captures are a sequence of 24-byte little-endian records:
+    uint64 timestamp_us, uint32 id (bit 31 extended, bit 30 RTR),
+    uint8 len, uint8 reserved[3], uint8 data[8].
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "mcp2515_sim.h"
+#include "sim_bus.h"
+#include "mcp_can.h"
+#include "uCAN.h"
+
+#define REPLAY_INT_PIN 2
+
+typedef struct {
+  uint64_t timestamp;               // us
+  SimFrame frame;
+} CaptureRecord;
+
+static SimBus *bus;
+static uint64_t work_ns = 0;
+static uint32_t handled = 0;
+
+static void tick(uint64_t now) {
+	bus->run(now);
+}
+
+static int hexValue(char c) {
+	if(c >= '0' && c <= '9')
+		return c - '0';
+	if(c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if(c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+static bool parseCandump(const char *line, CaptureRecord *record) {
+	unsigned long long sec, usec;
+	char frame[64];
+
+	if(sscanf(line, " (%llu.%llu) %*s %63s", &sec, &usec, frame) != 3)
+		return false;
+	record->timestamp = sec * 1000000ULL + usec;
+
+	char *hash = strchr(frame, '#');
+	if(hash == NULL || hash[1] == '#')
+		return false;                   // CAN FD is not supported by the MCP2515
+	*hash = '\0';
+	memset(&record->frame, 0, sizeof(record->frame));
+	record->frame.ext = strlen(frame) > 3;
+	record->frame.id = strtoul(frame, NULL, 16);
+
+	const char *data = hash + 1;
+	if(*data == 'R' || *data == 'r') {
+		record->frame.rtr = true;
+		record->frame.len = isdigit(data[1]) ? data[1] - '0' : 0;
+		return true;
+	}
+	while(record->frame.len < 8) {
+		if(*data == '.')
+			data++;
+		int hi = hexValue(data[0]), lo = hi < 0 ? -1 : hexValue(data[1]);
+		if(hi < 0 || lo < 0)
+			break;
+		record->frame.data[record->frame.len++] = (hi << 4) | lo;
+		data += 2;
+	}
+	return true;
+}
+
+static bool loadCapture(const char *path, bool binary, std::vector<CaptureRecord> *records) {
+	FILE *f = fopen(path, binary ? "rb" : "r");
+	if(f == NULL) {
+		perror(path);
+		return false;
+	}
+
+	if(binary) {
+		uint8_t raw[24];
+		while(fread(raw, sizeof(raw), 1, f) == 1) {
+			CaptureRecord record;
+			uint32_t id = 0;
+			record.timestamp = 0;
+			for(int i = 7; i >= 0; i--)
+				record.timestamp = (record.timestamp << 8) | raw[i];
+			for(int i = 11; i >= 8; i--)
+				id = (id << 8) | raw[i];
+			record.frame.ext = (id & 0x80000000UL) != 0;
+			record.frame.rtr = (id & 0x40000000UL) != 0;
+			record.frame.id = id & 0x1FFFFFFFUL;
+			record.frame.len = raw[12] > 8 ? 8 : raw[12];
+			memcpy(record.frame.data, raw + 16, 8);
+			records->push_back(record);
+		}
+	} else {
+		char line[256];
+		while(fgets(line, sizeof(line), f) != NULL) {
+			CaptureRecord record;
+			if(parseCandump(line, &record))
+				records->push_back(record);
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+static int speedSetting(uint32_t bitrate) {
+	static const struct { uint32_t rate; int setting; } settings[] = {
+		{5000, CAN_5KBPS}, {10000, CAN_10KBPS}, {20000, CAN_20KBPS}, {40000, CAN_40KBPS},
+		{50000, CAN_50KBPS}, {80000, CAN_80KBPS}, {100000, CAN_100KBPS}, {125000, CAN_125KBPS},
+		{200000, CAN_200KBPS}, {250000, CAN_250KBPS}, {500000, CAN_500KBPS}, {1000000, CAN_1000KBPS},
+	};
+	for(size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+		if(settings[i].rate == bitrate)
+			return settings[i].setting;
+	}
+	return -1;
+}
+
+static void broadcastHandler(uint8_t sender, uint8_t protocol, uint16_t subfields, uint8_t len, uint8_t *data) {
+	handled++;
+	hostAdvance(work_ns);
+}
+
+static BroadcastHandlers all_broadcasts[UCAN_BROADCAST_PROTOCOLS + 1];
+
+int main(int argc, char **argv) {
+	bool binary = false, use_ucan = false, use_int = false;
+	double factor = 1.0;
+	uint32_t bitrate = 125000;
+	uint8_t node_id = 1;
+	int opt;
+
+	while((opt = getopt(argc, argv, "bx:r:un:iw:v")) != -1) {
+		switch(opt) {
+		case 'b': binary = true; break;
+		case 'x': factor = atof(optarg); break;
+		case 'r': bitrate = strtoul(optarg, NULL, 10); break;
+		case 'u': use_ucan = true; break;
+		case 'n': node_id = strtoul(optarg, NULL, 0); break;
+		case 'i': use_int = true; break;
+		case 'w': work_ns = (uint64_t)(atof(optarg) * 1000); break;
+		case 'v': hostSetVerbose(true); break;
+		default:
+			fprintf(stderr, "usage: %s [-b] [-x factor] [-r bitrate] [-u] [-n node] [-i] [-w us] [-v] capture\n", argv[0]);
+			return 2;
+		}
+	}
+	if(optind >= argc || factor <= 0) {
+		fprintf(stderr, "usage: %s [-b] [-x factor] [-r bitrate] [-u] [-n node] [-i] [-w us] [-v] capture\n", argv[0]);
+		return 2;
+	}
+	int speed = speedSetting(bitrate);
+	if(speed < 0 || (use_ucan && speed != CAN_125KBPS)) {
+		fprintf(stderr, "unsupported bit rate %u\n", bitrate);
+		return 2;
+	}
+
+	std::vector<CaptureRecord> records;
+	if(!loadCapture(argv[optind], binary, &records))
+		return 1;
+	if(records.empty()) {
+		fprintf(stderr, "%s: no frames\n", argv[optind]);
+		return 1;
+	}
+
+	MCP2515Sim chip(SPICS, use_int ? REPLAY_INT_PIN : MCP_NO_INT_PIN);
+	bus = new SimBus(bitrate);
+	bus->attach(&chip);
+	hostSetTickHandler(tick);
+
+	if(use_int)
+		CAN.setIntPin(REPLAY_INT_PIN);
+	if(use_ucan) {
+		HardwareID hardware_id = {{0x02, 0x00, 0x00, 0x00, 0x00, node_id}};
+		for(uint8_t p = 0; p < UCAN_BROADCAST_PROTOCOLS; p++) {
+			BroadcastHandlers handlers = {p, 0, UCAN_BROADCAST_SUBFIELDS_MAX, broadcastHandler};
+			all_broadcasts[p] = handlers;
+		}
+		all_broadcasts[UCAN_BROADCAST_PROTOCOLS].handler = NULL;
+		uCAN.configureBroadcasts(all_broadcasts);
+		if(uCAN.begin(hardware_id, node_id) != CAN_OK) {
+			fprintf(stderr, "uCAN.begin failed\n");
+			return 1;
+		}
+	} else if(CAN.begin(speed) != CAN_OK) {
+		fprintf(stderr, "CAN.begin failed\n");
+		return 1;
+	}
+
+	// Replay relative to now, scaled by the speed factor
+	uint64_t start = hostNanos();
+	uint64_t first = records[0].timestamp;
+	for(size_t i = 0; i < records.size(); i++)
+		bus->inject(records[i].frame, start + (uint64_t)((records[i].timestamp - first) * 1000.0 / factor));
+	SimStats before = chip.stats;
+	uint64_t bus_before = bus->busy_ns;
+
+	// Run until the capture has been played out and the controller drained
+	uint32_t idle_polls = 0;
+	while(idle_polls < 1000) {
+		bool got;
+		if(use_ucan) {
+			got = uCAN.service(255, 10) > 0;
+		} else if((got = CAN.checkReceive() == CAN_MSGAVAIL)) {
+			INT8U len, buf[MAX_CHAR_IN_MESSAGE];
+			CAN.readMsgBuf(&len, buf);
+			handled++;
+			hostAdvance(work_ns);
+		}
+		idle_polls = (got || !bus->idle()) ? 0 : idle_polls + 1;
+	}
+
+	uint64_t elapsed = hostNanos() - start;
+	uint32_t received = chip.stats.received - before.received;
+	uint32_t overruns = chip.stats.overruns - before.overruns;
+	uint32_t latencies = chip.stats.read_latency_count - before.read_latency_count;
+	uint64_t latency_total = chip.stats.read_latency_total - before.read_latency_total;
+
+	printf("capture frames      %zu\n", records.size());
+	printf("replay time         %.3f ms (x%g)\n", elapsed / 1e6, factor);
+	printf("bus utilisation     %.1f %%\n", 100.0 * (bus->busy_ns - bus_before) / elapsed);
+	printf("source backlog max  %u frames\n", bus->external_backlog_max);
+	printf("accepted            %u\n", received);
+	printf("filtered            %zu\n", records.size() - received - overruns);
+	printf("dropped (overrun)   %u\n", overruns);
+	printf("handled             %u\n", handled);
+	printf("read latency        mean %.1f us, max %.1f us\n",
+		latencies ? latency_total / 1e3 / latencies : 0.0, chip.stats.read_latency_max / 1e3);
+	printf("spi transactions    %u (%.1f per accepted frame)\n", chip.stats.spi_transactions - before.spi_transactions,
+		received ? (double)(chip.stats.spi_transactions - before.spi_transactions) / received : 0.0);
+	printf("frames transmitted  %u\n", chip.stats.transmitted - before.transmitted);
+	printf("frame pool peak     %u of %u\n", CANPool.highWater(), CAN_FRAME_POOL_SIZE);
+	return overruns ? 3 : 0;
+}
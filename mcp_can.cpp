@@ -20,11 +20,58 @@
   1301  USA
 */
 #include "mcp_can.h"
+#ifdef __AVR__
+#include <avr/sleep.h>
+#endif
 
 #define spi_readwrite SPI.transfer
 #define spi_read() spi_readwrite(0x00)
 
 MCP_CAN CAN;
+MCP_CAN *MCP_CAN::m_pIntInstances[MCP_N_INT_INSTANCES];
+#if !defined(__AVR__) && !(defined(__ARM_ARCH_PROFILE) && __ARM_ARCH_PROFILE == 'M') && !defined(ESP8266)
+volatile INT8U gCANAtomicDepth = 0;                                     /* see CAN_ATOMIC_BEGIN         */
+#endif
+
+/*********************************************************************************************************
+** Function name:           MCP_CAN
+** Descriptions:            constructor, cs is the pin wired to the controller's /CS
+*********************************************************************************************************/
+MCP_CAN::MCP_CAN(INT8U cs)
+{
+    m_nCSPin = cs;
+    m_nIntPin = MCP_NO_INT_PIN;
+    m_SPISettings = SPISettings(MCP_SPI_CLOCK, MSBFIRST, MCP_SPI_MODE);
+    m_nTxOrdered = 0;
+    for (INT8U i = 0; i < MCP_N_TXBUFFERS; i++)
+    {
+        m_nTxPrio[i] = 0;
+    }
+    m_nIntFlag = 0;
+    for (INT8U i = 0; i < MCP_N_FRAME_HOOKS; i++)
+    {
+        m_pFrameHooks[i] = NULL;
+        m_pFrameHookContexts[i] = NULL;
+    }
+    m_pReplies = NULL;
+    m_nReplies = 0;
+    m_nTxBuffers = MCP_N_TXBUFFERS;
+    m_nReplyLoaded = MCP_NO_REPLY;
+}
+
+/*********************************************************************************************************
+** Function name:           isr0, isr1
+** Descriptions:            /INT falling edge handlers, one per controller with an interrupt pin
+*********************************************************************************************************/
+void MCP_CAN::isr0(void)
+{
+    m_pIntInstances[0]->m_nIntFlag = 1;
+}
+
+void MCP_CAN::isr1(void)
+{
+    m_pIntInstances[1]->m_nIntFlag = 1;
+}
 /*********************************************************************************************************
 ** Function name:           mcp2515_reset
 ** Descriptions:            reset the device
@@ -439,17 +486,25 @@ void MCP_CAN::mcp2515_read_id( const INT8U mcp_addr, INT8U* ext, INT32U* id )
 ** Descriptions:            write msg
 *********************************************************************************************************/
 void MCP_CAN::mcp2515_write_canMsg( const INT8U buffer_sidh_addr)
+{
+    mcp2515_load_txbuf(buffer_sidh_addr, m_nID, m_nExtFlg, m_nRtr, m_nDlc, m_nDta);
+}
+
+/*********************************************************************************************************
+** Function name:           mcp2515_load_txbuf
+** Descriptions:            write a frame to a tx buffer, leaving m_n* alone
+*********************************************************************************************************/
+void MCP_CAN::mcp2515_load_txbuf( const INT8U buffer_sidh_addr, const INT32U id, const INT8U ext,
+                                  const INT8U rtr, const INT8U len, const INT8U *buf )
 {
     INT8U mcp_addr;
     mcp_addr = buffer_sidh_addr;
-    mcp2515_setRegisterS(mcp_addr+5, m_nDta, m_nDlc );                  /* write data bytes             */
-    if ( m_nRtr == 1)                                                   /* if RTR set bit in byte       */
+    if ( !rtr )                                                         /* a remote frame has no data   */
     {
-        m_nDlc |= MCP_RTR_MASK;  
+        mcp2515_setRegisterS(mcp_addr+5, buf, len );                    /* write data bytes             */
     }
-    mcp2515_setRegister((mcp_addr+4), m_nDlc );                        /* write the RTR and DLC        */
-    mcp2515_write_id(mcp_addr, m_nExtFlg, m_nID );                     /* write CAN id                 */
-
+    mcp2515_setRegister((mcp_addr+4), rtr ? (len | MCP_RTR_MASK) : len ); /* write the RTR and DLC     */
+    mcp2515_write_id(mcp_addr, ext, id );                               /* write CAN id                 */
 }
 
 /*********************************************************************************************************
@@ -458,20 +513,25 @@ void MCP_CAN::mcp2515_write_canMsg( const INT8U buffer_sidh_addr)
 *********************************************************************************************************/
 void MCP_CAN::mcp2515_read_canMsg( const INT8U buffer_sidh_addr)        /* read can msg                 */
 {
-    INT8U mcp_addr, ctrl;
+    INT8U mcp_addr, sidl;
 
     mcp_addr = buffer_sidh_addr;
 
     mcp2515_read_id( mcp_addr, &m_nExtFlg,&m_nID );
 
-    ctrl = mcp2515_readRegister( mcp_addr-1 );
+    m_nfilhit = mcp2515_readRegister( mcp_addr-1 );                     /* RXBnCTRL                     */
+    m_nfilhit &= (mcp_addr == MCP_RXBUF_0) ? MCP_RXB0_FILHIT_M : MCP_RXB1_FILHIT_M;
+
     m_nDlc = mcp2515_readRegister( mcp_addr+4 );
 
-    if ((ctrl & 0x08)) {
-        m_nRtr = 1;
+    if ( m_nExtFlg )                                                    /* extended: RTR in RXBnDLC     */
+    {
+        m_nRtr = (m_nDlc & MCP_RXB_RTR_M) ? 1 : 0;
     }
-    else {
-        m_nRtr = 0;
+    else                                                                /* standard: SRR in RXBnSIDL    */
+    {
+        sidl = mcp2515_readRegister( mcp_addr+1 );
+        m_nRtr = (sidl & MCP_RXB_SRR_M) ? 1 : 0;
     }
 
     m_nDlc &= MCP_DLC_MASK;
@@ -484,6 +544,12 @@ void MCP_CAN::mcp2515_read_canMsg( const INT8U buffer_sidh_addr)        /* read
 *********************************************************************************************************/
 void MCP_CAN::mcp2515_start_transmit(const INT8U mcp_addr)              /* start transmit               */
 {
+    if (m_nTxOrdered)
+    {
+        mcp2515_modifyRegister( mcp_addr-1 , MCP_TXB_TXREQ_M | MCP_TXB_TXP10_M,
+                                MCP_TXB_TXREQ_M | m_nTxPrio[(mcp_addr-1-MCP_TXB0CTRL) >> 4] );
+        return;
+    }
     mcp2515_modifyRegister( mcp_addr-1 , MCP_TXB_TXREQ_M, MCP_TXB_TXREQ_M );
 }
 
@@ -499,8 +565,33 @@ INT8U MCP_CAN::mcp2515_getNextFreeTXBuf(INT8U *txbuf_n)                 /* get N
     res = MCP_ALLTXBUSY;
     *txbuf_n = 0x00;
 
-                                                                        /* check all 3 TX-Buffers       */
-    for (i=0; i<MCP_N_TXBUFFERS; i++) {
+    if (m_nTxOrdered)                                                   /* the controller sends highest */
+    {                                                                   /* TXP first, then the highest  */
+        INT8U key, lowest = 4 * MCP_N_TXBUFFERS;                        /* buffer number: rank buffers  */
+        ctrlval = mcp2515_readStatus();                                 /* by TXP * 3 + n and load each */
+        for (i = 0; i < m_nTxBuffers; i++)                              /* frame just below the lowest  */
+        {                                                               /* ranked frame still pending   */
+            key = m_nTxPrio[i] * MCP_N_TXBUFFERS + i;
+            if ((ctrlval & (MCP_STAT_TX0REQ << (2 * i))) && key < lowest)
+            {
+                lowest = key;
+            }
+        }
+        for (key = lowest; key-- > 0; )
+        {
+            i = key % MCP_N_TXBUFFERS;
+            if (i < m_nTxBuffers && (ctrlval & (MCP_STAT_TX0REQ << (2 * i))) == 0)
+            {
+                m_nTxPrio[i] = key / MCP_N_TXBUFFERS;
+                *txbuf_n = ctrlregs[i]+1;
+                return MCP2515_OK;
+            }
+        }
+        return res;                                                     /* wait for the rest to drain   */
+    }
+
+                                                                        /* check all 3 TX-Buffers, or 2 */
+    for (i=0; i<m_nTxBuffers; i++) {                                    /* when TXB2 holds replies      */
         ctrlval = mcp2515_readRegister( ctrlregs[i] );
         if ( (ctrlval & MCP_TXB_TXREQ_M) == 0 ) {
             *txbuf_n = ctrlregs[i]+1;                                   /* return SIDH-address of Buffe */
@@ -520,8 +611,15 @@ INT8U MCP_CAN::begin(INT8U speedset)
 {
     INT8U res;
 
+    pinMode(m_nCSPin, OUTPUT);
+    digitalWrite(m_nCSPin, HIGH);
     SPI.begin();
     res = mcp2515_init(speedset);
+    m_nReplyLoaded = MCP_NO_REPLY;
+    if (res == MCP2515_OK && m_nTxBuffers < MCP_N_TXBUFFERS)
+    {
+        mcp2515_modifyRegister(MCP_TXB2CTRL, MCP_TXB_TXP10_M, MCP_TXB_TXP10_M); /* replies go first     */
+    }
     if (res == MCP2515_OK) return CAN_OK;
     else return CAN_FAILINIT;
 }
@@ -634,15 +732,16 @@ INT8U MCP_CAN::init_Filt(INT8U num, INT8U ext, INT32U ulData)
 ** Function name:           setMsg
 ** Descriptions:            set can message, such as dlc, id, dta[] and so on
 *********************************************************************************************************/
-INT8U MCP_CAN::setMsg(INT32U id, INT8U ext, INT8U len, INT8U *pData)
+INT8U MCP_CAN::setMsg(INT32U id, INT8U ext, INT8U len, INT8U *pData, INT8U rtr)
 {
     int i = 0;
     m_nExtFlg = ext;
     m_nID     = id;
     m_nDlc    = len;
+    m_nRtr    = rtr;
     for(i = 0; i<MAX_CHAR_IN_MESSAGE; i++)
-    m_nDta[i] = *(pData+i);
-    return MCP2515_OK;
+    m_nDta[i] = !rtr && i < len ? *(pData+i) : 0;                       /* don't read past the caller's */
+    return MCP2515_OK;                                                  /* buffer; remote: no data      */
 }
 
 /*********************************************************************************************************
@@ -683,10 +782,11 @@ INT8U MCP_CAN::sendMsg()
     uiTimeOut = 0;
     mcp2515_write_canMsg( txbuf_n);
     mcp2515_start_transmit( txbuf_n );
+    notifyFrame(MCP_FRAME_TX);
     do
     {
         uiTimeOut++;        
-        res1= CAN.mcp2515_readRegister(txbuf_n);  			                /* read send buff ctrl reg 	*/
+        res1= mcp2515_readRegister(txbuf_n-1);                          /* read send buff ctrl reg      */
         res1 = res1 & 0x08;                               		
     }while(res1 && (uiTimeOut < TIMEOUTVALUE));   
     if(uiTimeOut == TIMEOUTVALUE)                                       /* send msg timeout             */	
@@ -704,7 +804,37 @@ INT8U MCP_CAN::sendMsg()
 INT8U MCP_CAN::sendMsgBuf(INT32U id, INT8U ext, INT8U len, INT8U *buf)
 {
     setMsg(id, ext, len, buf);
-    sendMsg();
+    return sendMsg();
+}
+
+/*********************************************************************************************************
+** Function name:           trySendMsgBuf
+** Descriptions:            load buf into a free tx buffer and request transmission without waiting
+**                          for it to complete, returns CAN_TXBUSY if all tx buffers are in use
+*********************************************************************************************************/
+INT8U MCP_CAN::trySendMsgBuf(INT32U id, INT8U ext, INT8U len, INT8U *buf)
+{
+    return trySendMsg(id, ext, 0, len, buf);
+}
+
+/*********************************************************************************************************
+** Function name:           trySendMsg
+** Descriptions:            load a frame into a free tx buffer and request transmission, or return
+**                          CAN_TXBUSY without touching m_n* if all tx buffers are in use
+*********************************************************************************************************/
+INT8U MCP_CAN::trySendMsg(INT32U id, INT8U ext, INT8U rtr, INT8U len, INT8U *buf)
+{
+    INT8U txbuf_n;
+
+    if(mcp2515_getNextFreeTXBuf(&txbuf_n) != MCP2515_OK)
+    {
+        return CAN_TXBUSY;
+    }
+    setMsg(id, ext, len, buf, rtr);
+    mcp2515_write_canMsg( txbuf_n);
+    mcp2515_start_transmit( txbuf_n );
+    notifyFrame(MCP_FRAME_TX);
+    return CAN_OK;
 }
 
 /*********************************************************************************************************
@@ -733,6 +863,14 @@ INT8U MCP_CAN::readMsg()
     {
         res = CAN_NOMSG;
     }
+    if (res == CAN_OK)
+    {
+        notifyFrame(MCP_FRAME_RX);
+        if (m_nRtr && m_nReplies)
+        {
+            answerRemoteRequest();
+        }
+    }
     return res;
 }
 
@@ -742,12 +880,13 @@ INT8U MCP_CAN::readMsg()
 *********************************************************************************************************/
 INT8U MCP_CAN::readMsgBuf(INT8U *len, INT8U buf[])
 {
-    readMsg();
+    INT8U res = readMsg();
     *len = m_nDlc;
     for(int i = 0; i<m_nDlc; i++)
     {
       buf[i] = m_nDta[i];
     }
+    return res;
 }
 
 /*********************************************************************************************************
@@ -757,6 +896,10 @@ INT8U MCP_CAN::readMsgBuf(INT8U *len, INT8U buf[])
 INT8U MCP_CAN::checkReceive(void)
 {
     INT8U res;
+    if ( m_nIntPin != MCP_NO_INT_PIN && digitalRead(m_nIntPin) == HIGH )
+    {
+        return CAN_NOMSG;                                               /* /INT idle, skip the spi read */
+    }
     res = mcp2515_readStatus();                                         /* RXnIF in Bit 1 and 0         */
     if ( res & MCP_STAT_RXIF_MASK ) 
     {
@@ -794,6 +937,574 @@ INT32U MCP_CAN::getCanId(void)
 {
     return m_nID;
 }
+
+/*********************************************************************************************************
+** Function name:           isExtendedFrame
+** Descriptions:            1 if the frame last read has a 29 bit id
+*********************************************************************************************************/
+INT8U MCP_CAN::isExtendedFrame(void)
+{
+    return m_nExtFlg;
+}
+
+/*********************************************************************************************************
+** Function name:           isRemoteRequest
+** Descriptions:            1 if the frame last read is a remote transmission request
+*********************************************************************************************************/
+INT8U MCP_CAN::isRemoteRequest(void)
+{
+    return m_nRtr;
+}
+
+/*********************************************************************************************************
+** Function name:           getFilterHit
+** Descriptions:            the acceptance filter (0-5) the frame last read matched. frames that rolled
+**                          over from RXB0 to RXB1 still report filter 0 or 1. meaningless when the rx
+**                          buffers are set to receive any frame
+*********************************************************************************************************/
+INT8U MCP_CAN::getFilterHit(void)
+{
+    return m_nfilhit;
+}
+
+/*********************************************************************************************************
+** Function name:           setIntPin
+** Descriptions:            set the pin wired to the mcp2515 /INT output, MCP_NO_INT_PIN if none.
+**                          the pin must support attachInterrupt, and at most MCP_N_INT_INSTANCES
+**                          controllers can have one
+*********************************************************************************************************/
+void MCP_CAN::setIntPin(INT8U pin)
+{
+    INT8U i, slot = MCP_N_INT_INSTANCES;
+    void (*isrs[MCP_N_INT_INSTANCES])(void) = { isr0, isr1 };
+
+    for (i = 0; i < MCP_N_INT_INSTANCES; i++)                           /* find our slot or a free one  */
+    {
+        if ( m_pIntInstances[i] == this || (m_pIntInstances[i] == NULL && slot == MCP_N_INT_INSTANCES) )
+        {
+            slot = i;
+        }
+    }
+    if ( m_nIntPin != MCP_NO_INT_PIN )
+    {
+        detachInterrupt(digitalPinToInterrupt(m_nIntPin));
+    }
+
+    m_nIntPin = pin;
+    m_nIntFlag = 0;
+    if ( pin == MCP_NO_INT_PIN || slot == MCP_N_INT_INSTANCES )
+    {
+        if ( slot < MCP_N_INT_INSTANCES && m_pIntInstances[slot] == this )
+        {
+            m_pIntInstances[slot] = NULL;
+        }
+        return;
+    }
+
+    pinMode(pin, INPUT);
+    m_pIntInstances[slot] = this;
+    attachInterrupt(digitalPinToInterrupt(pin), isrs[slot], FALLING);
+}
+
+/*********************************************************************************************************
+** Function name:           getIntPin
+** Descriptions:            get the pin wired to the mcp2515 /INT output
+*********************************************************************************************************/
+INT8U MCP_CAN::getIntPin(void)
+{
+    return m_nIntPin;
+}
+
+/*********************************************************************************************************
+** Function name:           waitForInterrupt
+** Descriptions:            wait up to timeout ms for a received message without touching the spi bus.
+**                          returns CAN_MSGAVAIL as soon as /INT is low, or CAN_NOMSG on timeout.
+**                          without an interrupt pin this falls back to checkReceive
+*********************************************************************************************************/
+INT8U MCP_CAN::waitForInterrupt(INT32U timeout)
+{
+    unsigned long start = millis();
+
+    if ( m_nIntPin == MCP_NO_INT_PIN )
+    {
+        return checkReceive();
+    }
+    do
+    {
+        m_nIntFlag = 0;
+        if ( digitalRead(m_nIntPin) == LOW )                            /* /INT is level, may already   */
+        {                                                               /* be low from an earlier frame */
+            return CAN_MSGAVAIL;
+        }
+#ifdef __AVR__
+        set_sleep_mode(SLEEP_MODE_IDLE);                                /* until /INT or the next tick  */
+        noInterrupts();
+        if ( !m_nIntFlag )
+        {
+            sleep_enable();
+            interrupts();
+            sleep_cpu();
+            sleep_disable();
+        }
+        interrupts();
+#endif
+    } while ( m_nIntFlag || (unsigned long)(millis() - start) < timeout );
+
+    return digitalRead(m_nIntPin) == LOW ? CAN_MSGAVAIL : CAN_NOMSG;
+}
+
+/*********************************************************************************************************
+** Function name:           sleep
+** Descriptions:            put the mcp2515 to sleep with the wake-up interrupt enabled, so /INT goes
+**                          low on the next bus activity
+*********************************************************************************************************/
+INT8U MCP_CAN::sleep(void)
+{
+    INT8U res;
+
+    res = mcp2515_setCANCTRL_Mode(MODE_CONFIG);                         /* CNF3 is only writable here   */
+    if(res > 0)
+    {
+        return res;
+    }
+    mcp2515_modifyRegister(MCP_CNF3, WAKFIL_ENABLE, WAKFIL_ENABLE);     /* ignore glitches on the bus   */
+    mcp2515_modifyRegister(MCP_CANINTF, MCP_WAKIF, 0);
+    mcp2515_modifyRegister(MCP_CANINTE, MCP_WAKIF, MCP_WAKIF);
+    return mcp2515_setCANCTRL_Mode(MODE_SLEEP);
+}
+
+/*********************************************************************************************************
+** Function name:           wake
+** Descriptions:            leave sleep (the mcp2515 wakes into listen-only mode) and return to normal
+**                          mode. the frame that caused the wake-up is not received
+*********************************************************************************************************/
+INT8U MCP_CAN::wake(void)
+{
+    INT8U res;
+
+    mcp2515_modifyRegister(MCP_CANINTF, MCP_WAKIF, MCP_WAKIF);          /* wakes it if still asleep     */
+    res = mcp2515_setCANCTRL_Mode(MODE_NORMAL);
+    mcp2515_modifyRegister(MCP_CANINTE, MCP_WAKIF, 0);
+    mcp2515_modifyRegister(MCP_CANINTF, MCP_WAKIF, 0);
+    return res;
+}
+/*********************************************************************************************************
+** Function name:           setFrameHook
+** Descriptions:            make hook the only function called with every frame read from the rx buffers
+**                          or loaded for transmission, or remove every hook if it is NULL
+*********************************************************************************************************/
+void MCP_CAN::setFrameHook(MCP_FRAME_HOOK hook, void *context)
+{
+    CAN_ATOMIC_BEGIN();
+    for (INT8U i = 0; i < MCP_N_FRAME_HOOKS; i++)
+    {
+        m_pFrameHooks[i] = NULL;
+    }
+    m_pFrameHooks[0] = hook;
+    m_pFrameHookContexts[0] = context;
+    CAN_ATOMIC_END();
+}
+
+/*********************************************************************************************************
+** Function name:           addFrameHook
+** Descriptions:            register a function called with every frame read from the rx buffers or
+**                          loaded for transmission, alongside any others. CAN_FAIL if
+**                          MCP_N_FRAME_HOOKS are already registered
+*********************************************************************************************************/
+INT8U MCP_CAN::addFrameHook(MCP_FRAME_HOOK hook, void *context)
+{
+    INT8U i, slot = MCP_N_FRAME_HOOKS;
+
+    if (hook == NULL)
+    {
+        return CAN_FAIL;
+    }
+    CAN_ATOMIC_BEGIN();
+    for (i = MCP_N_FRAME_HOOKS; i-- > 0; )
+    {
+        if (m_pFrameHooks[i] == hook && m_pFrameHookContexts[i] == context)
+        {
+            break;                                                      /* already registered           */
+        }
+        if (m_pFrameHooks[i] == NULL)
+        {
+            slot = i;
+        }
+    }
+    if (i == 0xFF && slot < MCP_N_FRAME_HOOKS)
+    {
+        m_pFrameHookContexts[slot] = context;
+        m_pFrameHooks[slot] = hook;
+        i = slot;
+    }
+    CAN_ATOMIC_END();
+    return i < MCP_N_FRAME_HOOKS ? CAN_OK : CAN_FAIL;
+}
+
+/*********************************************************************************************************
+** Function name:           removeFrameHook
+** Descriptions:            unregister a hook added with the same context
+*********************************************************************************************************/
+void MCP_CAN::removeFrameHook(MCP_FRAME_HOOK hook, void *context)
+{
+    CAN_ATOMIC_BEGIN();
+    for (INT8U i = 0; i < MCP_N_FRAME_HOOKS; i++)
+    {
+        if (m_pFrameHooks[i] == hook && m_pFrameHookContexts[i] == context)
+        {
+            m_pFrameHooks[i] = NULL;
+        }
+    }
+    CAN_ATOMIC_END();
+}
+
+/*********************************************************************************************************
+** Function name:           notifyFrame
+** Descriptions:            pass the current message to the frame hooks
+*********************************************************************************************************/
+void MCP_CAN::notifyFrame(INT8U dir)
+{
+    callFrameHooks(dir, m_nID, m_nExtFlg, m_nRtr, m_nDlc, m_nDta);
+}
+
+/*********************************************************************************************************
+** Function name:           callFrameHooks
+** Descriptions:            pass a frame to every registered hook
+*********************************************************************************************************/
+void MCP_CAN::callFrameHooks(INT8U dir, INT32U id, INT8U ext, INT8U rtr, INT8U len, const INT8U *buf)
+{
+    for (INT8U i = 0; i < MCP_N_FRAME_HOOKS; i++)
+    {
+        MCP_FRAME_HOOK hook = m_pFrameHooks[i];
+        if (hook)
+        {
+            hook(m_pFrameHookContexts[i], dir, id, ext, rtr, len, buf);
+        }
+    }
+}
+
+/*********************************************************************************************************
+** Function name:           setOrderedTx
+** Descriptions:            when set, frames are transmitted in the order they were loaded. Each frame
+**                          is given a lower TXBnCTRL priority than those still pending, which allows
+**                          up to twelve loads before the buffers have to drain completely
+*********************************************************************************************************/
+void MCP_CAN::setOrderedTx(INT8U ordered)
+{
+    m_nTxOrdered = ordered;
+}
+
+/*********************************************************************************************************
+** Function name:           setSPISettings
+** Descriptions:            set the spi clock in hz (the mcp2515 takes up to 10MHz; the core rounds down
+**                          to what it can generate) and mode, SPI_MODE0 or SPI_MODE3. takes effect
+**                          from the next access
+*********************************************************************************************************/
+void MCP_CAN::setSPISettings(INT32U clock, INT8U mode)
+{
+    m_SPISettings = SPISettings(clock, MSBFIRST, mode);
+}
+
+/*********************************************************************************************************
+** Function name:           usingInterrupt
+** Descriptions:            declare that this controller is accessed from the handler for interrupt, so
+**                          transactions on other spi devices hold it off. not needed for setIntPin,
+**                          whose handler doesn't touch the spi bus
+*********************************************************************************************************/
+void MCP_CAN::usingInterrupt(INT8U interrupt)
+{
+    SPI.usingInterrupt(interrupt);
+}
+
+/*********************************************************************************************************
+** Function name:           sendRemoteRequest
+** Descriptions:            send a remote frame asking for a len byte data frame with this id
+*********************************************************************************************************/
+INT8U MCP_CAN::sendRemoteRequest(INT32U id, INT8U ext, INT8U len)
+{
+    setMsg(id, ext, len, NULL, 1);
+    return sendMsg();
+}
+
+/*********************************************************************************************************
+** Function name:           trySendRemoteRequest
+** Descriptions:            as sendRemoteRequest, but returns CAN_TXBUSY rather than waiting for a buffer
+*********************************************************************************************************/
+INT8U MCP_CAN::trySendRemoteRequest(INT32U id, INT8U ext, INT8U len)
+{
+    return trySendMsg(id, ext, 1, len, NULL);
+}
+
+/*********************************************************************************************************
+** Function name:           mcp2515_requestToSend
+** Descriptions:            start transmission with a one byte MCP_RTS_TXn instruction
+*********************************************************************************************************/
+void MCP_CAN::mcp2515_requestToSend(const INT8U instruction)
+{
+    MCP2515_SELECT();
+    spi_readwrite(instruction);
+    MCP2515_UNSELECT();
+}
+
+/*********************************************************************************************************
+** Function name:           setRemoteReplies
+** Descriptions:            answer remote frames for the ids in replies (sorted by ext, then id) straight
+**                          from readMsg, so the reply goes out as soon as the request is read, wherever
+**                          that happens. with reserveTxb2 the last reply stays loaded in TXB2 at the
+**                          highest priority, and answering it again is a single RTS instruction; other
+**                          frames then have two tx buffers. call after begin(). count 0 turns it off
+*********************************************************************************************************/
+void MCP_CAN::setRemoteReplies(MCP_REMOTE_REPLY *replies, INT8U count, INT8U reserveTxb2)
+{
+    INT8U i;
+
+    m_pReplies = replies;
+    m_nReplies = count;
+    m_nReplyLoaded = MCP_NO_REPLY;
+    for (i = 0; i < count; i++)
+    {
+        replies[i].answered = 0;
+    }
+
+    if (reserveTxb2 && count)
+    {
+        m_nTxBuffers = MCP_N_TXBUFFERS - 1;
+        mcp2515_modifyRegister(MCP_TXB2CTRL, MCP_TXB_TXP10_M, MCP_TXB_TXP10_M);
+    }
+    else
+    {
+        m_nTxBuffers = MCP_N_TXBUFFERS;
+        mcp2515_modifyRegister(MCP_TXB2CTRL, MCP_TXB_TXP10_M, 0);
+    }
+}
+
+/*********************************************************************************************************
+** Function name:           updateRemoteReply
+** Descriptions:            change the cached reply at index. safe against readMsg in an isr
+*********************************************************************************************************/
+void MCP_CAN::updateRemoteReply(INT8U index, INT8U len, INT8U *buf)
+{
+    MCP_REMOTE_REPLY *reply = &m_pReplies[index];
+
+    if (len > MAX_CHAR_IN_MESSAGE)
+    {
+        len = MAX_CHAR_IN_MESSAGE;
+    }
+    CAN_ATOMIC_BEGIN();
+    reply->len = len;
+    memcpy(reply->data, buf, len);
+    if (m_nReplyLoaded == index)
+    {
+        m_nReplyLoaded = MCP_NO_REPLY;                                  /* reload on the next request   */
+    }
+    CAN_ATOMIC_END();
+}
+
+/*********************************************************************************************************
+** Function name:           findRemoteReply
+** Descriptions:            binary search of the reply table, ordered by (ext, id)
+*********************************************************************************************************/
+MCP_REMOTE_REPLY *MCP_CAN::findRemoteReply(INT32U id, INT8U ext)
+{
+    INT8U lo = 0, hi = m_nReplies;
+
+    while (lo < hi)
+    {
+        INT8U mid = (lo + hi) / 2;
+        MCP_REMOTE_REPLY *reply = &m_pReplies[mid];
+        if (ext < reply->ext || (ext == reply->ext && id < reply->id))
+        {
+            hi = mid;
+        }
+        else if (ext > reply->ext || id > reply->id)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            return reply;
+        }
+    }
+    return NULL;
+}
+
+/*********************************************************************************************************
+** Function name:           answerRemoteRequest
+** Descriptions:            send the cached reply to the remote frame in m_n*, if there is one. if no tx
+**                          buffer is free the request goes unanswered and the requester must ask again
+*********************************************************************************************************/
+void MCP_CAN::answerRemoteRequest(void)
+{
+    INT8U txbuf_n;
+    MCP_REMOTE_REPLY *reply = findRemoteReply(m_nID, m_nExtFlg);
+
+    if (reply == NULL)
+    {
+        return;
+    }
+
+    if (m_nTxBuffers < MCP_N_TXBUFFERS &&                               /* TXB2 is ours and idle        */
+        (mcp2515_readStatus() & (MCP_STAT_TX0REQ << 4)) == 0)
+    {
+        if (m_nReplyLoaded != reply - m_pReplies)
+        {
+            mcp2515_load_txbuf(MCP_TXB2CTRL+1, reply->id, reply->ext, 0, reply->len, reply->data);
+            m_nReplyLoaded = reply - m_pReplies;
+        }
+        mcp2515_requestToSend(MCP_RTS_TX2);
+    }
+    else if (m_nTxBuffers < MCP_N_TXBUFFERS && m_nReplyLoaded == reply - m_pReplies)
+    {
+        return;                                                         /* already on its way           */
+    }
+    else if (mcp2515_getNextFreeTXBuf(&txbuf_n) == MCP2515_OK)
+    {
+        mcp2515_load_txbuf(txbuf_n, reply->id, reply->ext, 0, reply->len, reply->data);
+        mcp2515_start_transmit(txbuf_n);
+    }
+    else
+    {
+        return;
+    }
+
+    reply->answered++;
+    callFrameHooks(MCP_FRAME_TX, reply->id, reply->ext, 0, reply->len, reply->data);
+}
+
+/*********************************************************************************************************
+** Function name:           autoBaud
+** Descriptions:            find the rate of a running bus by listening at each candidate in turn (by
+**                          default every CAN_xxxKBPS, commonest first) until one receives a frame, then
+**                          begin() at that rate. listen-only mode never acks or sends error frames, so
+**                          wrong guesses are invisible to the bus. in listen-only the error counters
+**                          don't move, so a wrong rate shows up as MERRF in CANINTF and we move on
+**                          without waiting out the window. gives up after timeout ms and returns
+**                          CAN_NOKBPS; an idle bus can't be detected
+*********************************************************************************************************/
+static const INT8U autoBaudRates[] = {
+    CAN_500KBPS, CAN_250KBPS, CAN_125KBPS, CAN_1000KBPS, CAN_100KBPS, CAN_50KBPS,
+    CAN_200KBPS, CAN_80KBPS, CAN_40KBPS, CAN_20KBPS, CAN_10KBPS, CAN_5KBPS
+};
+
+INT8U MCP_CAN::autoBaud(INT32U timeout, const INT8U *rates, INT8U count)
+{
+    INT8U i, flags;
+    unsigned long start, listening;
+
+    if (rates == NULL || count == 0)
+    {
+        rates = autoBaudRates;
+        count = sizeof(autoBaudRates);
+    }
+
+    pinMode(m_nCSPin, OUTPUT);
+    digitalWrite(m_nCSPin, HIGH);
+    SPI.begin();
+    mcp2515_reset();
+    if (mcp2515_setCANCTRL_Mode(MODE_CONFIG) != MCP2515_OK)
+    {
+        return CAN_NOKBPS;
+    }
+    mcp2515_initCANBuffers();
+    mcp2515_setRegister(MCP_CANINTE, 0);                                /* we poll, don't disturb /INT  */
+    mcp2515_modifyRegister(MCP_RXB0CTRL,                                /* any frame, even if its id    */
+        MCP_RXB_RX_MASK | MCP_RXB_BUKT_MASK,                            /* is too short for the filters */
+        MCP_RXB_RX_ANY | MCP_RXB_BUKT_MASK);
+    mcp2515_modifyRegister(MCP_RXB1CTRL, MCP_RXB_RX_MASK, MCP_RXB_RX_ANY);
+
+    start = millis();
+    for (i = 0; (unsigned long)(millis() - start) < timeout; i = (i + 1) % count)
+    {
+        mcp2515_setCANCTRL_Mode(MODE_CONFIG);
+        if (mcp2515_configRate(rates[i]) != MCP2515_OK)
+        {
+            continue;
+        }
+        mcp2515_setRegister(MCP_CANINTF, 0);
+        mcp2515_modifyRegister(MCP_EFLG, MCP_EFLG_RX1OVR | MCP_EFLG_RX0OVR, 0);
+        if (mcp2515_setCANCTRL_Mode(MODE_LISTENONLY) != MCP2515_OK)
+        {
+            continue;
+        }
+
+        listening = millis();
+        do
+        {
+            flags = mcp2515_readRegister(MCP_CANINTF);
+            if (flags & (MCP_RX0IF | MCP_RX1IF))                        /* a frame passed its crc       */
+            {
+                return begin(rates[i]) == CAN_OK ? rates[i] : CAN_NOKBPS;
+            }
+        } while (!(flags & MCP_MERRF) &&
+                 (unsigned long)(millis() - listening) < MCP_AUTOBAUD_WINDOW &&
+                 (unsigned long)(millis() - start) < timeout);
+    }
+
+    mcp2515_setCANCTRL_Mode(MODE_CONFIG);                               /* off the bus until begin()    */
+    return CAN_NOKBPS;
+}
+
+/*********************************************************************************************************
+** Function name:           sendMsgBufTimed
+** Descriptions:            send buf and wait for it to go out, storing micros() at the first poll that
+**                          saw it complete in *sent. unlike sendMsg the wait is bounded in time, not
+**                          polls, so it works at any bit rate; after MCP_TIMED_TX_TIMEOUT ms the frame
+**                          is aborted and CAN_SENDMSGTIMEOUT returned. CAN_TXBUSY if no tx buffer is free
+*********************************************************************************************************/
+INT8U MCP_CAN::sendMsgBufTimed(INT32U id, INT8U ext, INT8U len, INT8U *buf, INT32U *sent)
+{
+    INT8U txbuf_n;
+    unsigned long start;
+    INT32U now;
+
+    if(mcp2515_getNextFreeTXBuf(&txbuf_n) != MCP2515_OK)
+    {
+        return CAN_TXBUSY;
+    }
+    setMsg(id, ext, len, buf);
+    mcp2515_write_canMsg(txbuf_n);
+    mcp2515_start_transmit(txbuf_n);
+    start = millis();
+    do
+    {
+        now = micros();
+        if ((mcp2515_readRegister(txbuf_n-1) & MCP_TXB_TXREQ_M) == 0)
+        {
+            *sent = now;
+            notifyFrame(MCP_FRAME_TX);
+            return CAN_OK;
+        }
+    } while ((unsigned long)(millis() - start) < MCP_TIMED_TX_TIMEOUT);
+
+    mcp2515_modifyRegister(txbuf_n-1, MCP_TXB_TXREQ_M, 0);              /* abort, it would be late      */
+    return CAN_SENDMSGTIMEOUT;
+}
+
+/*********************************************************************************************************
+** Function name:           init_Filters
+** Descriptions:            set both masks and all six filters in one pass through configuration mode,
+**                          so the controller drops off the bus once rather than eight times
+*********************************************************************************************************/
+INT8U MCP_CAN::init_Filters(INT8U ext, const INT32U masks[2], const INT32U filters[6])
+{
+    static const INT8U filt_addr[6] = {MCP_RXF0SIDH, MCP_RXF1SIDH, MCP_RXF2SIDH,
+                                       MCP_RXF3SIDH, MCP_RXF4SIDH, MCP_RXF5SIDH};
+    INT8U res;
+
+    res = mcp2515_setCANCTRL_Mode(MODE_CONFIG);
+    if (res != MCP2515_OK)
+    {
+        return res;
+    }
+    mcp2515_write_id(MCP_RXM0SIDH, ext, masks[0]);
+    mcp2515_write_id(MCP_RXM1SIDH, ext, masks[1]);
+    for (INT8U i = 0; i < 6; i++)
+    {
+        mcp2515_write_id(filt_addr[i], ext, filters[i]);
+    }
+    return mcp2515_setCANCTRL_Mode(MODE_NORMAL);
+}
+
 /*********************************************************************************************************
   END FILE
 *********************************************************************************************************/
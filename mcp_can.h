@@ -25,6 +25,18 @@
 #include "mcp_can_dfs.h"
 #define MAX_CHAR_IN_MESSAGE 8
 
+typedef void (*MCP_FRAME_HOOK)(void *context, INT8U dir, INT32U id,  /* called for each frame read   */
+                               INT8U ext, INT8U rtr, INT8U len,       /* or queued for transmission   */
+                               const INT8U *buf);
+
+typedef struct {                                                        /* answer to remote requests    */
+    INT32U id;                                                          /* for id; tables are sorted by */
+    INT8U  ext;                                                         /* ext, then id                 */
+    INT8U  len;
+    INT8U  data[MAX_CHAR_IN_MESSAGE];
+    INT32U answered;                                                    /* maintained by the driver     */
+} MCP_REMOTE_REPLY;
+
 class MCP_CAN
 {
     private:
@@ -37,6 +49,22 @@ class MCP_CAN
     INT8U   m_nDta[MAX_CHAR_IN_MESSAGE];                            	/* data                         */
     INT8U   m_nRtr;                                                     /* rtr                          */
     INT8U   m_nfilhit;
+    INT8U   m_nCSPin;                                                   /* pin wired to /CS             */
+    INT8U   m_nIntPin;                                                  /* pin wired to /INT            */
+    SPISettings m_SPISettings;                                          /* spi clock and mode           */
+    INT8U   m_nTxOrdered;                                               /* keep tx in load order        */
+    INT8U   m_nTxPrio[MCP_N_TXBUFFERS];                                 /* TXP given to each tx buffer  */
+    volatile INT8U m_nIntFlag;                                          /* /INT fell since last wait    */
+    MCP_FRAME_HOOK m_pFrameHooks[MCP_N_FRAME_HOOKS];                    /* frame observers              */
+    void    *m_pFrameHookContexts[MCP_N_FRAME_HOOKS];
+    MCP_REMOTE_REPLY *m_pReplies;                                       /* auto-answered remote frames  */
+    INT8U   m_nReplies;
+    INT8U   m_nTxBuffers;                                               /* 2 when TXB2 holds replies    */
+    INT8U   m_nReplyLoaded;                                             /* reply in TXB2, or none       */
+
+    static MCP_CAN *m_pIntInstances[MCP_N_INT_INSTANCES];              /* targets of the isr stubs     */
+    static void isr0(void);
+    static void isr1(void);
 
 /*
 *  mcp2515 driver function 
@@ -78,27 +106,67 @@ class MCP_CAN
                                     INT32U* id );
 
     void mcp2515_write_canMsg( const INT8U buffer_sidh_addr );          /* write can msg                */
+    void mcp2515_load_txbuf( const INT8U buffer_sidh_addr,              /* write any frame to a buffer  */
+                             const INT32U id, const INT8U ext,
+                             const INT8U rtr, const INT8U len,
+                             const INT8U *buf );
+    void mcp2515_requestToSend(const INT8U instruction);                /* one byte RTS instruction     */
     void mcp2515_read_canMsg( const INT8U buffer_sidh_addr);            /* read can msg                 */
     void mcp2515_start_transmit(const INT8U mcp_addr);                  /* start transmit               */
     INT8U mcp2515_getNextFreeTXBuf(INT8U *txbuf_n);                     /* get Next free txbuf          */
+    void notifyFrame(INT8U dir);                                        /* pass m_n* to the frame hooks */
+    void callFrameHooks(INT8U dir, INT32U id, INT8U ext, INT8U rtr,     /* pass a frame to the hooks    */
+                        INT8U len, const INT8U *buf);
+    MCP_REMOTE_REPLY *findRemoteReply(INT32U id, INT8U ext);            /* reply for a remote frame     */
+    void answerRemoteRequest(void);                                     /* answer the frame in m_n*     */
 
 /*
 *  can operator function
 */    
 
-    INT8U setMsg(INT32U id, INT8U ext, INT8U len, INT8U *pData);    /* set message                  */  
+    INT8U setMsg(INT32U id, INT8U ext, INT8U len, INT8U *pData,     /* set message                  */
+                 INT8U rtr = 0);
+    INT8U trySendMsg(INT32U id, INT8U ext, INT8U rtr,               /* send without waiting         */
+                     INT8U len, INT8U *buf);
     INT8U clearMsg();                                               /* clear all message to zero    */
     INT8U readMsg();                                                /* read message                 */
     INT8U sendMsg();                                                /* send message                 */
 public:
+    MCP_CAN(INT8U cs = SPICS);
     INT8U begin(INT8U speedset);                              /* init can                     */
+    INT8U autoBaud(INT32U timeout, const INT8U *rates = NULL,       /* find the bus rate and begin  */
+                   INT8U count = 0);
     INT8U init_Mask(INT8U num, INT8U ext, INT32U ulData);           /* init Masks                   */
     INT8U init_Filt(INT8U num, INT8U ext, INT32U ulData);           /* init filters                 */
+    INT8U init_Filters(INT8U ext, const INT32U masks[2],            /* init every mask and filter   */
+                       const INT32U filters[6]);                    /* at once                      */
     INT8U sendMsgBuf(INT32U id, INT8U ext, INT8U len, INT8U *buf);  /* send buf                     */
+    INT8U trySendMsgBuf(INT32U id, INT8U ext, INT8U len, INT8U *buf); /* send buf without waiting    */
+    INT8U sendMsgBufTimed(INT32U id, INT8U ext, INT8U len,          /* send buf, return the micros()*/
+                          INT8U *buf, INT32U *sent);                /* when it left                 */
+    INT8U sendRemoteRequest(INT32U id, INT8U ext, INT8U len);       /* ask for a frame              */
+    INT8U trySendRemoteRequest(INT32U id, INT8U ext, INT8U len);    /* ... without waiting          */
     INT8U readMsgBuf(INT8U *len, INT8U *buf);                       /* read buf                     */
     INT8U checkReceive(void);                                       /* if something received        */
     INT8U checkError(void);                                         /* if something error           */
     INT32U getCanId(void);                                          /* get can id when receive      */
+    INT8U isExtendedFrame(void);                                    /* received frame is extended   */
+    INT8U isRemoteRequest(void);                                    /* received frame is rtr        */
+    INT8U getFilterHit(void);                                       /* filter the frame matched     */
+    void setIntPin(INT8U pin);                                      /* set pin wired to /INT        */
+    INT8U getIntPin(void);                                          /* get pin wired to /INT        */
+    INT8U waitForInterrupt(INT32U timeout);                         /* wait for /INT, timeout in ms */
+    INT8U sleep(void);                                              /* sleep until bus activity     */
+    INT8U wake(void);                                               /* return to normal mode        */
+    void setFrameHook(MCP_FRAME_HOOK hook, void *context);          /* replace every frame hook     */
+    INT8U addFrameHook(MCP_FRAME_HOOK hook, void *context);         /* observe frames sent/received */
+    void removeFrameHook(MCP_FRAME_HOOK hook, void *context);       /* stop observing               */
+    void setOrderedTx(INT8U ordered);                               /* send frames in load order    */
+    void setSPISettings(INT32U clock, INT8U mode);                  /* spi clock (hz) and mode      */
+    void usingInterrupt(INT8U interrupt);                           /* we are used from this isr    */
+    void setRemoteReplies(MCP_REMOTE_REPLY *replies, INT8U count,   /* answer remote frames from    */
+                          INT8U reserveTxb2);                       /* the receive path             */
+    void updateRemoteReply(INT8U index, INT8U len, INT8U *buf);     /* change a cached reply        */
 };
 
 extern MCP_CAN CAN;
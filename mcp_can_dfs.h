@@ -55,6 +55,8 @@
 #define MCP_RXB_RX_STDEXT   0x00
 #define MCP_RXB_RX_MASK     0x60
 #define MCP_RXB_BUKT_MASK   (1<<2)
+#define MCP_RXB0_FILHIT_M   0x01                                        /* In RXB0CTRL, RXF0 or RXF1    */
+#define MCP_RXB1_FILHIT_M   0x07                                        /* In RXB1CTRL, RXF0 to RXF5    */
 
 /*
 ** Bits in the TXBnCTRL registers.
@@ -69,11 +71,13 @@
 
 #define MCP_TXB_RTR_M       0x40                                        /* In TXBnDLC                   */
 #define MCP_RXB_IDE_M       0x08                                        /* In RXBnSIDL                  */
-#define MCP_RXB_RTR_M       0x40                                        /* In RXBnDLC                   */
+#define MCP_RXB_RTR_M       0x40                                        /* In RXBnDLC, extended frames  */
+#define MCP_RXB_SRR_M       0x10                                        /* In RXBnSIDL, standard frames */
 
 #define MCP_STAT_RXIF_MASK   (0x03)
 #define MCP_STAT_RX0IF (1<<0)
 #define MCP_STAT_RX1IF (1<<1)
+#define MCP_STAT_TX0REQ (1<<2)                                          /* TXBnCTRL.TXREQ at bit 2 + 2n */
 
 #define MCP_EFLG_RX1OVR (1<<7)
 #define MCP_EFLG_RX0OVR (1<<6)
@@ -302,8 +306,32 @@
 #define MCP_RXBUF_1 (MCP_RXB1SIDH)
 
 #define SPICS 10
-#define MCP2515_SELECT()   digitalWrite(SPICS, LOW)
-#define MCP2515_UNSELECT() digitalWrite(SPICS, HIGH)
+#define MCP_NO_INT_PIN 0xFF
+#define MCP_N_INT_INSTANCES 2                                           /* controllers with /INT wired  */
+#define MCP_FRAME_RX 0                                                  /* frame hook directions        */
+#define MCP_FRAME_TX 1
+#ifndef MCP_N_FRAME_HOOKS
+#define MCP_N_FRAME_HOOKS 4                                             /* frame observers per driver   */
+#endif
+#define MCP_NO_REPLY 0xFF                                               /* nothing preloaded in TXB2    */
+#ifndef MCP_AUTOBAUD_WINDOW
+#define MCP_AUTOBAUD_WINDOW 100                                         /* ms autoBaud listens per rate */
+#endif
+#ifndef MCP_TIMED_TX_TIMEOUT
+#define MCP_TIMED_TX_TIMEOUT 10                                         /* ms sendMsgBufTimed waits     */
+#endif
+#ifndef MCP_SPI_CLOCK
+#define MCP_SPI_CLOCK 10000000                                          /* mcp2515 maximum, hz          */
+#endif
+#define MCP_SPI_MODE SPI_MODE0                                          /* mode 0 or 3 both work        */
+
+/*
+ *   each /CS low period is one spi transaction, so other devices on the bus (and
+ *   their isrs, if registered with SPI.usingInterrupt) can't interleave. only
+ *   inside MCP_CAN members
+ */
+#define MCP2515_SELECT()   { SPI.beginTransaction(m_SPISettings); digitalWrite(m_nCSPin, LOW); }
+#define MCP2515_UNSELECT() { digitalWrite(m_nCSPin, HIGH); SPI.endTransaction(); }
 
 #define MCP2515_OK         (0)
 #define MCP2515_FAIL       (1)
@@ -322,6 +350,28 @@
 #define CANAUTOON  (1)
 #define CANAUTOOFF (0)
 
+/*
+ *   critical sections. on avr, cortex-m and esp8266 they save and restore the interrupt state, so
+ *   they nest and are safe inside an isr. elsewhere they fall back to noInterrupts()/interrupts()
+ *   with a nesting count: they nest, but the outermost one re-enables interrupts, so don't use
+ *   them from an isr there
+ */
+#if defined(__AVR__)
+#define CAN_ATOMIC_BEGIN() { uint8_t _sreg = SREG; cli();
+#define CAN_ATOMIC_END()   SREG = _sreg; }
+#elif defined(__ARM_ARCH_PROFILE) && __ARM_ARCH_PROFILE == 'M'
+#define CAN_ATOMIC_BEGIN() { uint32_t _primask; \
+                             __asm__ volatile ("mrs %0, primask\n\tcpsid i" : "=r" (_primask) :: "memory");
+#define CAN_ATOMIC_END()   __asm__ volatile ("msr primask, %0" :: "r" (_primask) : "memory"); }
+#elif defined(ESP8266)
+#define CAN_ATOMIC_BEGIN() { uint32_t _ps = xt_rsil(15);
+#define CAN_ATOMIC_END()   xt_wsr_ps(_ps); }
+#else
+extern volatile INT8U gCANAtomicDepth;
+#define CAN_ATOMIC_BEGIN() { noInterrupts(); gCANAtomicDepth++;
+#define CAN_ATOMIC_END()   if (--gCANAtomicDepth == 0) interrupts(); }
+#endif
+
 #define CAN_STDID (0)
 #define CAN_EXTID (1)
 
@@ -340,6 +390,7 @@
 #define CAN_250KBPS  10
 #define CAN_500KBPS  11
 #define CAN_1000KBPS 12
+#define CAN_NOKBPS   0                                                  /* autoBaud found no rate       */
 
 #define CAN_OK         (0)
 #define CAN_FAILINIT   (1)
@@ -349,6 +400,7 @@
 #define CAN_CTRLERROR  (5)
 #define CAN_GETTXBFTIMEOUT (6)
 #define CAN_SENDMSGTIMEOUT (7)
+#define CAN_TXBUSY     (8)
 #define CAN_FAIL       (0xff)
 
 #define CAN_MAX_CHAR_IN_MESSAGE (8)
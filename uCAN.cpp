@@ -1,48 +1,65 @@
 #include <Arduino.h>
+#ifdef __AVR__
+#include <avr/sleep.h>
+#endif
 #include "uCAN.h"
+#include "ucan_address.h"
+#include "ucan_heartbeat.h"
+#include "ucan_clock.h"
 
 uCAN_IMPL uCAN;
 
-uCAN_IMPL::uCAN_IMPL() {
+uCAN_IMPL::uCAN_IMPL(MCP_CAN *can, CANFramePool *pool) : tx_queue(pool, UCAN_TX_QUEUE_DEPTH) {
+	this->can = can;
+	this->pool = pool;
 	this->address_change_handler = NULL;
-	this->timeout = 1000;
+	this->address_server = NULL;
+	this->heartbeat_monitor = NULL;
+	this->heartbeat_period = 0;
+	this->clock = NULL;
+	this->time_sync_period = 0;
+	this->time_sync_seq = 0;
+	this->timeout = UCAN_DEFAULT_TIMEOUT;
+	this->timeout_floor = UCAN_DEFAULT_TIMEOUT_FLOOR;
+	this->retries = UCAN_DEFAULT_RETRIES;
+	for(uint8_t i = 0; i < UCAN_RTT_PEERS; i++)
+		this->rtt[i].node = UCAN_BROADCAST_NODE_ID;
 	this->registers = NULL;
+	for(uint8_t i = 0; i < UCAN_SUBSCRIPTIONS; i++)
+		this->subscriptions[i].node = UCAN_BROADCAST_NODE_ID;
+	this->notification_handler = NULL;
+	this->configureBroadcasts(NULL);
+	this->setNodeID(UCAN_BROADCAST_NODE_ID);
 }
 
 MessageID uCAN_IMPL::makeUnicastMessageID(uint8_t priority, uint8_t protocol, uint8_t subfields, uint8_t recipient) {
-	MessageID ret;
-	ret.unicast.broadcast = 0;
-	ret.unicast.priority = priority;
-	ret.unicast.protocol = protocol;
-	ret.unicast.subfields = subfields;
-	ret.unicast.recipient = recipient;
-	ret.unicast.sender = this->node_id;
-	return ret;
+	return UCAN_UNICAST_ID(priority, protocol, subfields, recipient, this->node_id);
 }
 
 MessageID uCAN_IMPL::makeBroadcastMessageID(uint8_t priority, uint8_t protocol, uint16_t subfields) {
-	MessageID ret;
-	ret.broadcast.broadcast = 1;
-	ret.broadcast.priority = priority;
-	ret.broadcast.protocol = protocol;
-	ret.broadcast.subfields = subfields;
-	ret.broadcast.sender = this->node_id;
-	return ret;
+	return UCAN_BROADCAST_ID(priority, protocol, subfields, this->node_id);
 }
 
 uint8_t uCAN_IMPL::begin(HardwareID hardware_id, uint8_t default_node_id) {
 	this->hardware_id = hardware_id;
 
-	uint8_t ret = CAN.begin(CAN_125KBPS);
+	uint8_t ret = this->can->begin(CAN_125KBPS);
 	if(ret != CAN_OK)
 		return ret;
 
-	// Ask for a centrally assigned node ID
-	this->node_id = 0xFF;
-	NodeAddress node = this->getNodeFromHardwareID(this->hardware_id);
+	// Ask for a centrally assigned node ID. An address server answers at once,
+	// or takes one from its own table; without one, only a node still using
+	// our hardware ID can answer.
+	this->setNodeID(UCAN_BROADCAST_NODE_ID);
+	ret = this->configureFilters();
+	if(ret != CAN_OK)
+		return ret;
+	NodeAddress node = this->address_server
+		? this->address_server->allocate(this->hardware_id)
+		: this->getNodeFromHardwareID(this->hardware_id);
 	if(node != UCAN_NODE_NOT_FOUND) {
-		this->node_id = node;
-		return CAN_OK;
+		this->setNodeID(node);
+		return this->configureFilters();
 	}
 
 	// Assign our own ID
@@ -51,29 +68,101 @@ uint8_t uCAN_IMPL::begin(HardwareID hardware_id, uint8_t default_node_id) {
 		// Another node with our ID already exists
 		default_node_id = (default_node_id + 1) & 0x7F;
 	}
-	this->node_id = default_node_id;
+	this->setNodeID(default_node_id);
 
-	return CAN_OK;
+	return this->configureFilters();
 }
 
 uint8_t uCAN_IMPL::begin(HardwareID hardware_id) {
 	return this->begin(hardware_id, hardware_id.address[5]);
 }
 
-void uCAN_IMPL::send(MessageID id, uint8_t len, uint8_t *message) {
-	CAN.sendMsgBuf(id.raw, 1, len, message);
+uint8_t uCAN_IMPL::getNodeID() {
+	return this->node_id;
 }
 
-bool uCAN_IMPL::tryReceive(uCANMessage *message) {
-	CAN.readMsgBuf(&message->len, message->body);
-	message->id.raw = CAN.getCanId();
+// Callers are responsible for reprogramming the acceptance filters afterwards
+void uCAN_IMPL::setNodeID(uint8_t node_id) {
+	this->node_id = node_id;
+	this->pong_match = UCAN_MATCH_YARP_PONG_VALUE | UCAN_ID_BITS(node_id, RECIPIENT);
+	this->address_match = UCAN_MATCH_YARP_ADDRESS_VALUE | UCAN_ID_BITS(node_id, RECIPIENT);
+	this->read_response_match = UCAN_MATCH_RAP_READ_RESPONSE_VALUE | UCAN_ID_BITS(node_id, RECIPIENT);
+	this->write_ack_match = UCAN_MATCH_RAP_WRITE_ACK_VALUE | UCAN_ID_BITS(node_id, RECIPIENT);
+	this->notify_match = UCAN_MATCH_RAP_NOTIFY_VALUE | UCAN_ID_BITS(node_id, RECIPIENT);
+}
 
-	if(message->id.broadcast.broadcast) {
-		switch(message->id.broadcast.protocol) {
+// Programs the MCP2515 acceptance filters so that only traffic we might act on
+// reaches the MCU. RXB0 takes unicasts addressed to us or to the broadcast node
+// ID and rolls over into RXB1, which takes everything with the broadcast bit set.
+// All eight registers are written in one trip through configuration mode,
+// which takes the controller off the bus.
+uint8_t uCAN_IMPL::configureFilters() {
+	INT32U masks[2] = {
+		UCAN_ID_FIELD_MASK(BROADCAST) | UCAN_ID_FIELD_MASK(RECIPIENT),
+		UCAN_ID_FIELD_MASK(BROADCAST),
+	};
+	INT32U filters[6] = {
+		UCAN_ID_BITS(this->node_id, RECIPIENT),
+		UCAN_ID_BITS(UCAN_BROADCAST_NODE_ID, RECIPIENT),
+		UCAN_ID_FIELD_MASK(BROADCAST),
+		UCAN_ID_FIELD_MASK(BROADCAST),
+		UCAN_ID_FIELD_MASK(BROADCAST),
+		UCAN_ID_FIELD_MASK(BROADCAST),
+	};
 
-		}
+	return this->can->init_Filters(1, masks, filters);
+}
+
+// Hands the message to a free transmit buffer without waiting for it to go
+// out. If all buffers are busy it is queued in the shared frame pool, and
+// only if that is exhausted do we wait for the controller to catch up, for
+// up to UCAN_SEND_TIMEOUT ms. Returns CAN_OK, or CAN_SENDMSGTIMEOUT if the
+// message was dropped, e.g. because nothing on the bus acknowledges our
+// frames.
+uint8_t uCAN_IMPL::send(MessageID id, uint8_t len, uint8_t *message) {
+	if(this->flushTransmitQueue() && this->can->trySendMsgBuf(id, 1, len, message) == CAN_OK)
+		return CAN_OK;
+
+	uint32_t start = millis();
+	while(!this->tx_queue.enqueue(id, 1, 0, len, message)) {
+		if(this->flushTransmitQueue() && this->can->trySendMsgBuf(id, 1, len, message) == CAN_OK)
+			return CAN_OK;
+		if((uint32_t)(millis() - start) >= UCAN_SEND_TIMEOUT)
+			return CAN_SENDMSGTIMEOUT;
+	}
+	return CAN_OK;
+}
+
+// Loads queued messages into free transmit buffers. Returns true once the
+// queue is empty.
+bool uCAN_IMPL::flushTransmitQueue() {
+	CANFrame *frame;
+	while((frame = this->tx_queue.peek()) != NULL) {
+		if(this->can->trySendMsgBuf(frame->id, frame->ext, frame->len, frame->data) != CAN_OK)
+			return false;
+		this->pool->release(this->tx_queue.pop());
+	}
+	return true;
+}
+
+// Waits up to timeout ms for a message to arrive. Returns early, with true,
+// while queued messages are still waiting for a transmit buffer, since the
+// controller doesn't interrupt us when one frees up.
+bool uCAN_IMPL::waitForTraffic(uint32_t timeout) {
+	if(!this->flushTransmitQueue())
+		return true;
+	return this->can->waitForInterrupt(timeout) == CAN_MSGAVAIL;
+}
+
+bool uCAN_IMPL::tryReceive(uCANMessage *message) {
+	this->rx_time = micros();
+	this->can->readMsgBuf(&message->len, message->body);
+	message->id = this->can->getCanId();
+
+	if(UCAN_ID_IS_BROADCAST(message->id)) {
+		return !this->handleBroadcast(message);
 	} else {
-		switch(message->id.unicast.protocol) {
+		switch(UCAN_ID_PROTOCOL(message->id)) {
 		case UCAN_PROTOCOL_YARP:
 			return !this->handleYARP(message);
 		case UCAN_PROTOCOL_RAP:
@@ -85,7 +174,14 @@ bool uCAN_IMPL::tryReceive(uCANMessage *message) {
 
 
 bool uCAN_IMPL::receive() {
-	if(CAN.checkReceive() != CAN_MSGAVAIL)
+	if(this->flushTransmitQueue()) {
+		this->sendTimeSync();
+		this->sendHeartbeat();
+		this->sendNotifications();
+	}
+	if(this->heartbeat_monitor)
+		this->heartbeat_monitor->check();
+	if(this->can->checkReceive() != CAN_MSGAVAIL)
 		return false;
 
 	uCANMessage message;
@@ -93,32 +189,255 @@ bool uCAN_IMPL::receive() {
 	return true;
 }
 
+// Handles pending messages until none are left, max_frames have been
+// handled or max_ms have passed. Returns the number of messages handled.
+uint8_t uCAN_IMPL::service(uint8_t max_frames, uint16_t max_ms) {
+	uint8_t handled = 0;
+	uint32_t start = millis();
+
+	while(handled < max_frames && max_ms > (uint32_t)(millis() - start)) {
+		if(!this->receive())
+			break;
+		handled++;
+	}
+	return handled;
+}
+
+#ifdef __AVR__
+static uint8_t wake_interrupt;
+
+static void wakeISR() {
+	// The wake-up interrupt is level triggered, so stop it firing repeatedly
+	detachInterrupt(wake_interrupt);
+}
+#endif
+
+// Puts the MCP2515 to sleep until there is activity on the bus and parks the
+// MCU until its /INT line fires: powered down on AVR, waiting in WFI on
+// Cortex-M. Elsewhere the MCU just polls /INT, so only the controller saves
+// power. Requires setIntPin() on the controller. Returns false without
+// sleeping if there is no interrupt pin or traffic is pending in either
+// direction, including change notifications held back by their subscriber's
+// interval.
+bool uCAN_IMPL::idle() {
+	uint8_t pin = this->can->getIntPin();
+	if(pin == MCP_NO_INT_PIN || !this->flushTransmitQueue() || !this->sendNotifications() ||
+	   this->can->checkReceive() == CAN_MSGAVAIL)
+		return false;
+	if(this->can->sleep() != MCP2515_OK) {
+		this->can->wake();
+		return false;
+	}
+
+#ifdef __AVR__
+	// Only a level interrupt can wake the MCU from power-down. Interrupts are
+	// re-enabled immediately before sleeping so a wake-up can't be missed.
+	wake_interrupt = digitalPinToInterrupt(pin);
+	set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+	noInterrupts();
+	attachInterrupt(wake_interrupt, wakeISR, LOW);
+	sleep_enable();
+	interrupts();
+	sleep_cpu();
+	sleep_disable();
+#elif defined(__ARM_ARCH_PROFILE) && __ARM_ARCH_PROFILE == 'M'
+	// WFI wakes on a pending interrupt even while they are masked, so /INT
+	// can't fall unseen between the check and the wait.
+	for(;;) {
+		__asm__ volatile ("cpsid i" ::: "memory");
+		if(digitalRead(pin) == LOW)
+			break;
+		__asm__ volatile ("wfi" ::: "memory");
+		__asm__ volatile ("cpsie i" ::: "memory");
+	}
+	__asm__ volatile ("cpsie i" ::: "memory");
+#else
+	while(digitalRead(pin) == HIGH);
+#endif
+
+	this->can->wake();
+	// Restore the /INT edge interrupt that the wake-up handler replaced
+	this->can->setIntPin(pin);
+	return true;
+}
+
+// Receives and handles at most one message, returning true if it matched
+// (mask, value) and was not consumed by a handler.
+bool uCAN_IMPL::pollMessage(MessageID mask, MessageID value, uCANMessage *message) {
+	if(this->can->checkReceive() != CAN_MSGAVAIL)
+		return false;
+	return this->tryReceive(message) && UCAN_ID_MATCHES(message->id, mask, value);
+}
+
+// Receives and handles messages until one matching (mask, value) that was not
+// consumed by a handler arrives, or until timeout ms have passed since start.
+// Between messages this sleeps on the /INT line rather than polling over SPI.
+bool uCAN_IMPL::waitForMessage(MessageID mask, MessageID value, uCANMessage *message, uint32_t start, uint16_t timeout) {
+	uint32_t elapsed;
+	while(timeout > (elapsed = millis() - start)) {
+		if(this->waitForTraffic(timeout - elapsed) && this->pollMessage(mask, value, message))
+			return true;
+	}
+	return false;
+}
+
+// Sends a request and waits for the reply: a message matching (mask, value)
+// whose body starts with the match_len bytes at match. Each attempt waits as
+// long as the RTT estimate for node suggests, doubling on every retry, and the
+// whole exchange never takes longer than the timeout ceiling. Gives up at
+// once if the request can't be sent; that says nothing about node.
+bool uCAN_IMPL::request(NodeAddress node, MessageID id, uint8_t len, uint8_t *body, MessageID mask, MessageID value,
+                        const uint8_t *match, uint8_t match_len, uCANMessage *message) {
+	uint32_t first = millis();
+	uint32_t first_us = micros();
+	uint16_t timeout;
+
+	for(uint8_t attempt = 0; attempt <= this->retries && (timeout = this->attemptTimeout(node, attempt, first)) > 0; attempt++) {
+		if(this->send(id, len, body) != CAN_OK)
+			return false;
+		uint32_t sent = micros();
+		if(attempt == 0)
+			first_us = sent;
+		uint32_t start = millis();
+		while(this->waitForMessage(mask, value, message, start, timeout)) {
+			if(match_len > 0 && memcmp(message->body, match, match_len) != 0)
+				continue;
+			// A reply to a retried request can't be matched to the attempt
+			// that caused it, so it backs the estimate off instead (Karn).
+			if(attempt == 0)
+				this->sampleRTT(UCAN_ID_SENDER(message->id), micros() - sent);
+			else
+				this->backoffRTT(UCAN_ID_SENDER(message->id), micros() - first_us);
+			return true;
+		}
+	}
+	this->markUnresponsive(node);
+	return false;
+}
+
+void uCAN_IMPL::sampleRTT(uint8_t node, uint32_t rtt) {
+	if(node == UCAN_BROADCAST_NODE_ID)
+		return;
+	if(rtt > 0xFFFF)
+		rtt = 0xFFFF;
+
+	RTTEstimate *estimate = &this->rtt[node % UCAN_RTT_PEERS];
+	if(estimate->node != node || estimate->srtt == 0) {
+		estimate->node = node;
+		estimate->srtt = rtt;
+		estimate->rttvar = rtt / 2;
+		return;
+	}
+	uint16_t error = rtt > estimate->srtt ? rtt - estimate->srtt : estimate->srtt - rtt;
+	estimate->rttvar = estimate->rttvar - estimate->rttvar / 4 + error / 4;
+	estimate->srtt = estimate->srtt - estimate->srtt / 8 + rtt / 8;
+}
+
+// The peer needed a retry to answer: widen its timeout until fresh samples
+// bring it back down. since_first is the time since the first attempt went
+// out; a peer marked unresponsive has no estimate to widen, so that seeds
+// one instead; it can only overstate the RTT.
+void uCAN_IMPL::backoffRTT(uint8_t node, uint32_t since_first) {
+	RTTEstimate *estimate = &this->rtt[node % UCAN_RTT_PEERS];
+	if(estimate->node != node)
+		return;
+	if(estimate->srtt == 0) {
+		this->sampleRTT(node, since_first);
+		return;
+	}
+	uint16_t wider = estimate->rttvar > estimate->srtt ? estimate->rttvar : estimate->srtt;
+	estimate->rttvar = wider > 0x7FFF ? 0xFFFF : wider * 2;
+}
+
+// The peer didn't answer at all. Assume it has gone away, so that asking it
+// again only costs the timeout floor and its retries; an answer re-seeds the
+// estimate. A slot holding another peer's estimate is left alone.
+void uCAN_IMPL::markUnresponsive(NodeAddress node) {
+	if(node < 0 || node >= UCAN_BROADCAST_NODE_ID)
+		return;
+	RTTEstimate *estimate = &this->rtt[node % UCAN_RTT_PEERS];
+	if(estimate->node != node && estimate->node != UCAN_BROADCAST_NODE_ID)
+		return;
+	estimate->node = node;
+	estimate->srtt = 0;
+	estimate->rttvar = 0;
+}
+
+// How long, in ms, to wait for a reply to attempt number attempt of a request
+// first sent at first. Peers we have no estimate for get the full ceiling.
+// Returns 0 once the ceiling has been used up.
+uint16_t uCAN_IMPL::attemptTimeout(NodeAddress node, uint8_t attempt, uint32_t first) {
+	uint32_t elapsed = millis() - first;
+	if(elapsed >= this->timeout)
+		return 0;
+	uint32_t remaining = this->timeout - elapsed;
+
+	uint32_t timeout = this->timeout;
+	RTTEstimate *estimate = &this->rtt[(uint8_t)node % UCAN_RTT_PEERS];
+	if(node >= 0 && node < UCAN_BROADCAST_NODE_ID && estimate->node == node) {
+		// SRTT + 4 * RTTVAR, rounded up to whole ms plus one for millis() granularity
+		uint32_t rto = (uint32_t)estimate->srtt + 4 * (uint32_t)estimate->rttvar;
+		timeout = (rto + 999) / 1000 + 1;
+		if(timeout < this->timeout_floor)
+			timeout = this->timeout_floor;
+		timeout <<= attempt;
+	}
+	return timeout < remaining ? timeout : remaining;
+}
+
+// Sets the longest any request may take, retries included
 void uCAN_IMPL::setTimeout(uint16_t timeout) {
 	this->timeout = timeout;
 }
 
+// Sets the shortest and longest time a request may wait for a reply and how
+// many times it is resent. Per-peer timeouts adapt between the two.
+void uCAN_IMPL::setTimeout(uint16_t floor, uint16_t ceiling, uint8_t retries) {
+	this->timeout_floor = floor;
+	this->timeout = ceiling;
+	this->retries = retries;
+}
+
+// The time a request to node would currently wait for a first reply, in ms
+uint16_t uCAN_IMPL::getTimeout(NodeAddress node) {
+	return this->attemptTimeout(node, 0, millis());
+}
+
 bool uCAN_IMPL::handleYARP(uCANMessage *message) {
-	if((message->id.unicast.subfields & 0x30) == 0x20) {
+	uint8_t subfields = UCAN_ID_UNICAST_SUBFIELDS(message->id);
+	if((subfields & 0x30) == 0x20) {
 		// Query
-		if(message->id.unicast.recipient != this->node_id && message->id.unicast.recipient != UCAN_BROADCAST_NODE_ID)
+		uint8_t recipient = UCAN_ID_RECIPIENT(message->id);
+		if(recipient != this->node_id && recipient != UCAN_BROADCAST_NODE_ID)
 			// Not addressed to us
 			return false;
-		if((message->id.unicast.subfields & 0x08) && memcmp(&this->hardware_id, message->body, sizeof(HardwareID)) != 0)
+		if((subfields & 0x08) && this->address_server && UCAN_ID_SENDER(message->id) == UCAN_BROADCAST_NODE_ID) {
+			// A node without an ID looking itself up: answer from the allocation table
+			HardwareID hardware_id;
+			memcpy(hardware_id.address, message->body, sizeof(HardwareID));
+			NodeAddress node = this->address_server->allocate(hardware_id);
+			if(node != UCAN_NODE_NOT_FOUND)
+				this->setAddress(hardware_id, node);
+			return true;
+		}
+		if((subfields & 0x08) && memcmp(&this->hardware_id, message->body, sizeof(HardwareID)) != 0)
 			// Not addressed to our hardware ID
 			return false;
 
 		this->send(
-			this->makeUnicastMessageID(message->id.unicast.priority, UCAN_PROTOCOL_YARP, 0x38, message->id.unicast.sender),
+			this->makeUnicastMessageID(UCAN_ID_PRIORITY(message->id), UCAN_PROTOCOL_YARP, 0x38, UCAN_ID_SENDER(message->id)),
 			6, this->hardware_id.address);
 		return true;
-	} else if((message->id.unicast.subfields & 0x38) == 0x18) {
+	} else if((subfields & 0x38) == 0x18) {
 		// Address assignment
-		if(memcmp(&this->hardware_id, message->body, sizeof(HardwareID)) == 0) {
-			this->node_id = message->body[6];
+		if(memcmp(&this->hardware_id, message->body, sizeof(HardwareID)) == 0 && message->body[6] != this->node_id) {
+			this->setNodeID(message->body[6]);
+			this->configureFilters();
 			if(this->address_change_handler)
 				this->address_change_handler(this->node_id);
 		}
-		return true;
+		// Left unconsumed for a lookup of this hardware ID to see
+		return false;
 	}
 	return false;
 }
@@ -128,25 +447,16 @@ NodeAddress uCAN_IMPL::getNodeFromNodeID(uint8_t node_id) {
 }
 
 NodeAddress uCAN_IMPL::getNodeFromHardwareID(HardwareID hardware_id) {
-	this->send(
-		this->makeUnicastMessageID(UCAN_PRIORITY_NORMAL, UCAN_PROTOCOL_YARP, 0x28, 0xFF),
-		sizeof(HardwareID), hardware_id.address);
-
-	uint32_t start = millis();
-	while(this->timeout > (uint32_t)(millis() - start)) {
-		if(CAN.checkReceive() == CAN_MSGAVAIL) {
-			uCANMessage message;
-			if(this->tryReceive(&message)) {
-				if(message.id.unicast.broadcast == 0 && message.id.unicast.protocol == UCAN_PROTOCOL_YARP &&
-				   (message.id.unicast.subfields & 0x38) == 0x38 && message.id.unicast.recipient == this->node_id) {
-					// Ping response to us!
-					if(memcmp(message.body, hardware_id.address, sizeof(HardwareID)) == 0) {
-						// From the node we queried
-						return message.id.unicast.sender;
-					}
-				}
-			}
-		}
+	// Ping response to us from the node we queried, or an address server's
+	// assignment to it
+	uCANMessage message;
+	if(this->request(UCAN_BROADCAST_NODE_ID,
+	                 this->makeUnicastMessageID(UCAN_PRIORITY_NORMAL, UCAN_PROTOCOL_YARP, 0x28, 0xFF),
+	                 sizeof(HardwareID), hardware_id.address,
+	                 UCAN_MATCH_YARP_ADDRESS_MASK, this->address_match, hardware_id.address, sizeof(HardwareID), &message)) {
+		if(UCAN_ID_UNICAST_SUBFIELDS(message.id) & 0x20)
+			return UCAN_ID_SENDER(message.id);
+		return message.body[6];
 	}
 	return UCAN_NODE_NOT_FOUND;
 }
@@ -156,25 +466,14 @@ bool uCAN_IMPL::ping(NodeAddress node) {
 }
 
 bool uCAN_IMPL::ping(NodeAddress node, HardwareID *hardware_id) {
-	this->send(this->makeUnicastMessageID(UCAN_PRIORITY_NORMAL, UCAN_PROTOCOL_YARP, 0x20, node), 0, NULL);
-
-	uint32_t start = millis();
-	while(this->timeout > (uint32_t)(millis() - start)) {
-		if(CAN.checkReceive() == CAN_MSGAVAIL) {
-			uCANMessage message;
-			if(this->tryReceive(&message)) {
-				if(message.id.unicast.broadcast == 0 && message.id.unicast.protocol == UCAN_PROTOCOL_YARP &&
-				   (message.id.unicast.subfields & 0x38) == 0x38 && message.id.unicast.recipient == this->node_id) {
-					// Ping response to us!
-					if(message.id.unicast.sender == node) {
-						// From the node we queried
-						if(hardware_id)
-							memcpy(hardware_id->address, message.body, sizeof(HardwareID));
-						return true;
-					}
-				}
-			}
-		}
+	// Ping response to us from the node we queried
+	uCANMessage message;
+	if(this->request(node, this->makeUnicastMessageID(UCAN_PRIORITY_NORMAL, UCAN_PROTOCOL_YARP, 0x20, node), 0, NULL,
+	                 UCAN_MATCH_YARP_PONG_MASK | UCAN_ID_FIELD_MASK(SENDER), this->pong_match | UCAN_ID_BITS(node, SENDER),
+	                 NULL, 0, &message)) {
+		if(hardware_id)
+			memcpy(hardware_id->address, message.body, sizeof(HardwareID));
+		return true;
 	}
 	return false;
 }
@@ -183,14 +482,23 @@ void uCAN_IMPL::registerAddressChangeHandler(AddressChangeHandler handler) {
 	this->address_change_handler = handler;
 }
 
-void uCAN_IMPL::setAddress(HardwareID hardware_id, uint8_t node_id) {
-	MessageID id;
+// Makes this node an address server for nodes starting up. It should be the
+// first node on the bus, or know every node ID already in use. Called before
+// begin(), the server's own ID comes from the table too; called after, the ID
+// it has is recorded in it.
+void uCAN_IMPL::configureAddressServer(uCANAddressServer *server) {
+	this->address_server = server;
+	if(server && this->node_id != UCAN_BROADCAST_NODE_ID)
+		server->assign(this->hardware_id, this->node_id);
+}
+
+bool uCAN_IMPL::setAddress(HardwareID hardware_id, uint8_t node_id) {
 	uint8_t body[7];
 
 	memcpy(body, &hardware_id.address, 6);
 	body[6] = node_id;
-	this->send(this->makeUnicastMessageID(UCAN_PRIORITY_HIGH, UCAN_PROTOCOL_YARP, 0x18, UCAN_BROADCAST_NODE_ID),
-		7, body);
+	return this->send(this->makeUnicastMessageID(UCAN_PRIORITY_HIGH, UCAN_PROTOCOL_YARP, 0x18, UCAN_BROADCAST_NODE_ID),
+		7, body) == CAN_OK;
 }
 
 // RAP methods
@@ -207,31 +515,68 @@ RegisterHandlers *uCAN_IMPL::findRegisterHandlers(uint8_t page) {
 }
 
 bool uCAN_IMPL::handleRAP(uCANMessage *message) {
+	uint8_t recipient = UCAN_ID_RECIPIENT(message->id);
+	if(recipient != this->node_id && recipient != UCAN_BROADCAST_NODE_ID)
+		// Not addressed to us
+		return false;
+
 	uint8_t page = message->body[0];
 	uint8_t reg = message->body[1];
-	uint8_t len = message->id.unicast.subfields & 0x07;
-	if((message->id.unicast.subfields & 0x30) == 0x20) {
-		// Register write
-		RegisterHandlers *handlers = this->findRegisterHandlers(page);
+	uint8_t subfields = UCAN_ID_UNICAST_SUBFIELDS(message->id);
+	uint8_t sender = UCAN_ID_SENDER(message->id);
+	uint8_t len = subfields & 0x07;
+	if((subfields & 0x30) == 0x20) {
+		// Register write, acknowledged if bit 3 is set. One too long for a
+		// frame, or shorter than it claims, is rejected unapplied.
+		bool valid = len <= UCAN_RAP_WRITE_MAX && message->len >= len + 2;
+		RegisterHandlers *handlers = valid ? this->findRegisterHandlers(page) : NULL;
 		if(handlers) {
 			for(uint8_t i = 0; i < len; i++)
-				handlers->write(message->id.unicast.sender, page, reg + i, message->body[i + 2]);
+				handlers->write(sender, page, reg + i, message->body[i + 2]);
+			this->notifyRegisterChanged(page, reg, len);
 		}
-	} else if((message->id.unicast.subfields & 0x30) == 0x00) {
-		// Register read
+
+		if(subfields & 0x08) {
+			uint8_t response[3];
+			response[0] = page;
+			response[1] = reg;
+			response[2] = handlers ? UCAN_STATUS_OK : UCAN_STATUS_REJECTED;
+			this->send(
+				this->makeUnicastMessageID(UCAN_ID_PRIORITY(message->id), UCAN_PROTOCOL_RAP, 0x30 | (len & 0x7), sender),
+				3, response);
+		}
+		return true;
+	} else if((subfields & 0x38) == 0x08) {
+		// Subscription to changes, every interval ms at most; length 0 cancels
+		uint16_t interval = message->len >= 4 ? message->body[2] | (message->body[3] << 8) : 0;
+		this->subscribe(sender, UCAN_ID_PRIORITY(message->id), page, reg, len, interval);
+		return true;
+	} else if((subfields & 0x38) == 0x18) {
+		// Change notification. Left unconsumed for subscribeRegisters to see the
+		// first one, which answers the subscription.
+		if(len > 0 && len <= UCAN_RAP_NOTIFY_MAX && message->len >= len + 2 && this->notification_handler)
+			this->notification_handler(sender, page, reg, len, message->body + 2);
+		return false;
+	} else if((subfields & 0x30) == 0x00) {
+		// Register read. The response couldn't carry more than
+		// UCAN_RAP_READ_MAX registers, so a longer request goes unanswered.
+		if(len > UCAN_RAP_READ_MAX || message->len < 2)
+			return true;
 		RegisterHandlers *handlers = this->findRegisterHandlers(page);
 		uint8_t response[8];
 		response[0] = page;
 		response[1] = reg;
 		if(handlers) {
 			for(uint8_t i = 0; i < len; i++)
-				response[i + 2] = handlers->read(message->id.unicast.sender, page, reg + i);
+				response[i + 2] = handlers->read(sender, page, reg + i);
 		}
 
 		this->send(
-			this->makeUnicastMessageID(message->id.unicast.priority, UCAN_PROTOCOL_RAP, 0x10 | (len & 0x7), message->id.unicast.sender),
+			this->makeUnicastMessageID(UCAN_ID_PRIORITY(message->id), UCAN_PROTOCOL_RAP, 0x10 | (len & 0x7), sender),
 			len + 2, response);
+		return true;
 	}
+	return false;
 }
 
 void uCAN_IMPL::configureRegisters(RegisterHandlers *handlers) {
@@ -239,38 +584,514 @@ void uCAN_IMPL::configureRegisters(RegisterHandlers *handlers) {
 }
 
 bool uCAN_IMPL::readRegisters(NodeAddress node, uint8_t page, uint8_t reg, uint8_t len, uint8_t *data) {
-	uint8_t body[2] = {page, len};
+	uint8_t body[2] = {page, reg};
+
+	// Read response to us from the node we queried
+	uCANMessage message;
+	if(this->request(node, this->makeUnicastMessageID(UCAN_PRIORITY_NORMAL, UCAN_PROTOCOL_RAP, 0x00 | (len & 0x07), node),
+	                 2, body, UCAN_MATCH_RAP_READ_RESPONSE_MASK | UCAN_ID_FIELD_MASK(SENDER),
+	                 this->read_response_match | UCAN_ID_BITS(node, SENDER), body, 2, &message)) {
+		memcpy(data, message.body + 2, len);
+		return true;
+	}
+	return false;
+}
 
-	this->send(
-		this->makeUnicastMessageID(UCAN_PRIORITY_NORMAL, UCAN_PROTOCOL_RAP, 0x00 | (len & 0x07), node),
-		2, body);
+// Unacknowledged write of up to UCAN_RAP_WRITE_MAX registers. Returns false
+// if it is too long or couldn't be sent.
+bool uCAN_IMPL::writeRegisters(NodeAddress node, uint8_t page, uint8_t reg, uint8_t len, uint8_t *data) {
+	if(len > UCAN_RAP_WRITE_MAX)
+		return false;
 
-	uint32_t start = millis();
-	while(this->timeout > (uint32_t)(millis() - start)) {
-		if(CAN.checkReceive() == CAN_MSGAVAIL) {
-			uCANMessage message;
-			if(this->tryReceive(&message)) {
-				if(message.id.unicast.broadcast == 0 && message.id.unicast.protocol == UCAN_PROTOCOL_RAP &&
-				   message.id.unicast.recipient == this->node_id && (message.id.unicast.subfields & 0x30) == 0x30) {
-				   	if(message.body[0] == page && message.body[1] == reg) {
-						memcpy(data, message.body + 2, len);
-						return true;
-					}
+	uint8_t body[8];
+	body[0] = page;
+	body[1] = reg;
+	memcpy(body + 2, data, len);
+
+	return this->send(
+		this->makeUnicastMessageID(UCAN_PRIORITY_NORMAL, UCAN_PROTOCOL_RAP, 0x20 | (len & 0x7), node),
+		len + 2, body) == CAN_OK;
+}
+
+// Reads the same registers from every node in nodes. Requests go out to all
+// nodes that haven't answered yet, then replies are collected until none has
+// arrived for as long as the slowest of them needs; nodes still silent are
+// asked again, up to the retry limit and the timeout ceiling. Node i's data is stored at
+// results + i * len and its outcome in status[i]. Returns the number of
+// nodes that replied.
+//
+// Requests queue behind each other on the bus, so replies here don't update
+// the RTT estimates; they only use them.
+uint8_t uCAN_IMPL::pollRegisters(NodeAddress *nodes, uint8_t count, uint8_t page, uint8_t reg, uint8_t len, uint8_t *results, uint8_t *status) {
+	uint8_t body[2] = {page, reg};
+	uint8_t replied = 0;
+	uint32_t first = millis();
+	uCANMessage message;
+
+	for(uint8_t i = 0; i < count; i++)
+		status[i] = UCAN_STATUS_PENDING;
+
+	for(uint8_t attempt = 0; attempt <= this->retries && replied < count && (uint32_t)(millis() - first) < this->timeout; attempt++) {
+		uint8_t next = 0;
+		uint16_t wait = 0;
+		uint32_t start = millis();
+		while(replied < count) {
+			while(next < count && status[next] != UCAN_STATUS_PENDING)
+				next++;
+			if(next < count) {
+				uint16_t timeout = this->attemptTimeout(nodes[next], attempt, first);
+				if(timeout > wait)
+					wait = timeout;
+				if(this->send(
+					this->makeUnicastMessageID(UCAN_PRIORITY_NORMAL, UCAN_PROTOCOL_RAP, 0x00 | (len & 0x07), nodes[next]),
+					2, body) == CAN_OK)
+					next++;
+				else
+					// Can't send; the rest would fail too
+					next = count;
+				start = millis();
+			} else {
+				// Requests still queued behind each other haven't been sent yet
+				if(!this->flushTransmitQueue())
+					start = millis();
+				uint32_t elapsed = millis() - start;
+				if(wait <= elapsed || (uint32_t)(millis() - first) >= this->timeout)
+					break;
+				// Without /INT this returns at once, so only the clock ends the wait
+				this->waitForTraffic(wait - elapsed);
+			}
+
+			// Keep draining replies while requests go out so the receive buffers
+			// never overflow.
+			if(!this->pollMessage(UCAN_MATCH_RAP_READ_RESPONSE_MASK, this->read_response_match, &message))
+				continue;
+			if(message.body[0] != page || message.body[1] != reg)
+				continue;
+			for(uint8_t i = 0; i < count; i++) {
+				if(nodes[i] == UCAN_ID_SENDER(message.id) && status[i] == UCAN_STATUS_PENDING) {
+					memcpy(results + i * len, message.body + 2, len);
+					status[i] = UCAN_STATUS_OK;
+					replied++;
+					// Replies queue behind each other too; wait for silence
+					start = millis();
+					break;
 				}
 			}
 		}
 	}
 
+	for(uint8_t i = 0; i < count; i++) {
+		if(status[i] == UCAN_STATUS_PENDING) {
+			status[i] = UCAN_STATUS_TIMEOUT;
+			this->markUnresponsive(nodes[i]);
+		}
+	}
+	return replied;
+}
+
+// Reads the same registers from every node on the bus with a single request
+// to the broadcast node ID. Node n's data is stored at results + n * len, and
+// bit n of the UCAN_MAX_NODES-bit bitmap replied is set if it answered.
+uint8_t uCAN_IMPL::pollRegisters(uint8_t page, uint8_t reg, uint8_t len, uint8_t *results, uint8_t *replied) {
+	uint8_t body[2] = {page, reg};
+	uint8_t count = 0;
+	uCANMessage message;
+
+	memset(replied, 0, UCAN_MAX_NODES / 8);
+	if(this->send(
+		this->makeUnicastMessageID(UCAN_PRIORITY_NORMAL, UCAN_PROTOCOL_RAP, 0x00 | (len & 0x07), UCAN_BROADCAST_NODE_ID),
+		2, body) != CAN_OK)
+		return 0;
+
+	uint32_t start = millis();
+	while(this->waitForMessage(UCAN_MATCH_RAP_READ_RESPONSE_MASK, this->read_response_match, &message, start, this->timeout)) {
+		uint8_t node = UCAN_ID_SENDER(message.id);
+		if(node >= UCAN_MAX_NODES || message.body[0] != page || message.body[1] != reg)
+			continue;
+		if(!(replied[node >> 3] & (1 << (node & 7)))) {
+			memcpy(results + node * len, message.body + 2, len);
+			replied[node >> 3] |= 1 << (node & 7);
+			count++;
+		}
+	}
+	return count;
+}
+
+// Asks node to send the values of registers reg..reg+len-1 of page whenever
+// they change, but no more than once every interval ms. The reply carries
+// their current values, which are stored in data and, like every change
+// after it, passed to the notification handler. Returns false if the node
+// didn't answer or has no room for another subscription. Subscribing again
+// changes the interval; subscriptions last until cancelled.
+bool uCAN_IMPL::subscribeRegisters(NodeAddress node, uint8_t page, uint8_t reg, uint8_t len, uint16_t interval, uint8_t *data) {
+	uint8_t body[4] = {page, reg, (uint8_t)interval, (uint8_t)(interval >> 8)};
+
+	// First notification to us from the node we subscribed to
+	uCANMessage message;
+	if(len == 0 || len > UCAN_RAP_NOTIFY_MAX ||
+	   !this->request(node, this->makeUnicastMessageID(UCAN_PRIORITY_NORMAL, UCAN_PROTOCOL_RAP, 0x08 | len, node),
+	                  4, body, UCAN_MATCH_RAP_NOTIFY_MASK | UCAN_ID_FIELD_MASK(SENDER),
+	                  this->notify_match | UCAN_ID_BITS(node, SENDER), body, 2, &message))
+		return false;
+	if(UCAN_ID_UNICAST_SUBFIELDS(message.id) & 0x07) {
+		memcpy(data, message.body + 2, len);
+		return true;
+	}
 	return false;
 }
 
-void uCAN_IMPL::writeRegisters(NodeAddress node, uint8_t page, uint8_t reg, uint8_t len, uint8_t *data) {
+// Returns false if the cancellation couldn't be sent
+bool uCAN_IMPL::unsubscribeRegisters(NodeAddress node, uint8_t page, uint8_t reg) {
+	uint8_t body[2] = {page, reg};
+
+	return this->send(this->makeUnicastMessageID(UCAN_PRIORITY_NORMAL, UCAN_PROTOCOL_RAP, 0x08, node), 2, body) == CAN_OK;
+}
+
+void uCAN_IMPL::registerNotificationHandler(NotificationHandler handler) {
+	this->notification_handler = handler;
+}
+
+// Adds, updates or (with len 0) removes sender's subscription to page and
+// reg. A new subscription is answered straight away with the current values;
+// a zero length answer means it was refused.
+void uCAN_IMPL::subscribe(uint8_t sender, uint8_t priority, uint8_t page, uint8_t reg, uint8_t len, uint16_t interval) {
+	Subscription *slot = NULL;
+	for(uint8_t i = 0; i < UCAN_SUBSCRIPTIONS; i++) {
+		Subscription *subscription = &this->subscriptions[i];
+		if(subscription->node == sender && subscription->page == page && subscription->reg == reg) {
+			slot = subscription;
+			break;
+		}
+		if(subscription->node == UCAN_BROADCAST_NODE_ID && slot == NULL)
+			slot = subscription;
+	}
+
+	if(len == 0) {
+		if(slot && slot->node == sender)
+			slot->node = UCAN_BROADCAST_NODE_ID;
+		return;
+	}
+
+	Subscription refused;
+	if(slot == NULL || sender == UCAN_BROADCAST_NODE_ID || len > UCAN_RAP_NOTIFY_MAX ||
+	   this->findRegisterHandlers(page) == NULL) {
+		slot = &refused;
+		len = 0;
+	}
+	slot->node = sender;
+	slot->priority = priority;
+	slot->page = page;
+	slot->reg = reg;
+	slot->len = len;
+	slot->interval = interval;
+	this->sendNotification(slot);
+}
+
+// Sends the current values to the subscriber. If configureRegisters() has
+// since dropped the page, the subscription is dropped too, and the
+// subscriber gets a zero length notification, as if it had been refused.
+void uCAN_IMPL::sendNotification(Subscription *subscription) {
+	RegisterHandlers *handlers = this->findRegisterHandlers(subscription->page);
+	if(handlers == NULL)
+		subscription->len = 0;
+
 	uint8_t body[8];
-	body[0] = page;
-	body[1] = reg;
-	memcpy(body + 2, data, len);
+	body[0] = subscription->page;
+	body[1] = subscription->reg;
+	for(uint8_t i = 0; i < subscription->len; i++)
+		body[i + 2] = handlers->read(subscription->node, subscription->page, subscription->reg + i);
 
-	this->send(
-		this->makeUnicastMessageID(UCAN_PRIORITY_NORMAL, UCAN_PROTOCOL_RAP, 0x20 | (len & 0x7), node),
-		len + 2, body);
+	subscription->sent = millis();
+	// A dropped notification goes again once the interval has passed
+	subscription->changed = this->send(
+		this->makeUnicastMessageID(subscription->priority, UCAN_PROTOCOL_RAP, 0x18 | subscription->len, subscription->node),
+		subscription->len + 2, body) != CAN_OK;
+	if(subscription->len == 0)
+		subscription->node = UCAN_BROADCAST_NODE_ID;
+}
+
+// Tells subscribers that registers reg..reg+len-1 of page have changed. Writes
+// over RAP do this themselves; call it when the application changes them.
+// Nothing is sent from here: changes are collected until the subscriber's
+// interval has passed, and only the latest values go out.
+void uCAN_IMPL::notifyRegisterChanged(uint8_t page, uint8_t reg, uint8_t len) {
+	for(uint8_t i = 0; i < UCAN_SUBSCRIPTIONS; i++) {
+		Subscription *subscription = &this->subscriptions[i];
+		if(subscription->node != UCAN_BROADCAST_NODE_ID && subscription->page == page &&
+		   reg < subscription->reg + subscription->len && subscription->reg < reg + len)
+			subscription->changed = true;
+	}
+}
+
+// Sends the notifications that are due, while there are free transmit
+// buffers. Returns true if none are left waiting.
+bool uCAN_IMPL::sendNotifications() {
+	bool done = true;
+	uint32_t now = millis();
+	for(uint8_t i = 0; i < UCAN_SUBSCRIPTIONS; i++) {
+		Subscription *subscription = &this->subscriptions[i];
+		if(subscription->node == UCAN_BROADCAST_NODE_ID || !subscription->changed)
+			continue;
+		if((uint32_t)(now - subscription->sent) < subscription->interval || !this->flushTransmitQueue()) {
+			done = false;
+			continue;
+		}
+		this->sendNotification(subscription);
+	}
+	return done;
+}
+
+// An acknowledged write waiting in the window
+typedef struct {
+	uint8_t index;
+	uint8_t attempt;
+	uint16_t wait;
+	uint32_t first;
+	uint32_t sent;
+	uint32_t sent_us;
+} PendingWrite;
+
+// A write that can't be sent is left to time out and be resent like a lost one
+bool uCAN_IMPL::sendWrite(RegisterWrite *write) {
+	uint8_t body[8];
+	body[0] = write->page;
+	body[1] = write->reg;
+	memcpy(body + 2, write->data, write->len);
+
+	return this->send(
+		this->makeUnicastMessageID(UCAN_PRIORITY_NORMAL, UCAN_PROTOCOL_RAP, 0x28 | (write->len & 0x7), write->node),
+		write->len + 2, body) == CAN_OK;
+}
+
+// Writes each entry of writes with acknowledgement, keeping up to
+// UCAN_RAP_WRITE_WINDOW writes outstanding at once. A write that isn't
+// acknowledged in time is resent, like any other request. Each entry's status
+// is updated as its acknowledgement arrives or it times out; returns the
+// number of writes that were acknowledged successfully. Entries longer than
+// UCAN_RAP_WRITE_MAX are never sent and come back UCAN_STATUS_REJECTED.
+uint8_t uCAN_IMPL::writeRegisters(RegisterWrite *writes, uint8_t count) {
+	PendingWrite window[UCAN_RAP_WRITE_WINDOW];
+	uint8_t in_flight = 0, next = 0, succeeded = 0;
+
+	while(next < count || in_flight > 0) {
+		// Fill the window
+		while(in_flight < UCAN_RAP_WRITE_WINDOW && next < count) {
+			if(writes[next].len > UCAN_RAP_WRITE_MAX) {
+				writes[next++].status = UCAN_STATUS_REJECTED;
+				continue;
+			}
+			PendingWrite *pending = &window[in_flight++];
+			writes[next].status = UCAN_STATUS_PENDING;
+			this->sendWrite(&writes[next]);
+			pending->index = next++;
+			pending->attempt = 0;
+			pending->first = pending->sent = millis();
+			pending->sent_us = micros();
+			pending->wait = this->attemptTimeout(writes[pending->index].node, 0, pending->first);
+		}
+		if(in_flight == 0)
+			// Only rejected entries were left
+			break;
+
+		// Sleep until the next acknowledgement or the earliest deadline
+		uint32_t now = millis();
+		uint32_t until = 0xFFFFFFFFUL;
+		for(uint8_t i = 0; i < in_flight; i++) {
+			uint32_t elapsed = now - window[i].sent;
+			uint32_t left = window[i].wait > elapsed ? window[i].wait - elapsed : 0;
+			if(left < until)
+				until = left;
+		}
+
+		// Match an acknowledgement against the oldest outstanding write it
+		// could belong to; a node acknowledges writes in the order it got them.
+		uCANMessage message;
+		int8_t done = -1;
+		if(until > 0 && this->waitForTraffic(until) &&
+		   this->pollMessage(UCAN_MATCH_RAP_WRITE_ACK_MASK, this->write_ack_match, &message)) {
+			for(uint8_t i = 0; i < in_flight; i++) {
+				RegisterWrite *write = &writes[window[i].index];
+				if(write->node == UCAN_ID_SENDER(message.id) && write->page == message.body[0] && write->reg == message.body[1]) {
+					write->status = message.body[2];
+					if(write->status == UCAN_STATUS_OK)
+						succeeded++;
+					if(window[i].attempt == 0)
+						this->sampleRTT(write->node, micros() - window[i].sent_us);
+					else
+						this->backoffRTT(write->node, micros() - window[i].sent_us);
+					done = i;
+					break;
+				}
+			}
+		}
+
+		// Resend or give up on the first write whose attempt has expired
+		for(uint8_t i = 0; done < 0 && i < in_flight; i++) {
+			PendingWrite *pending = &window[i];
+			if((uint32_t)(millis() - pending->sent) < pending->wait)
+				continue;
+			RegisterWrite *write = &writes[pending->index];
+			uint16_t wait = pending->attempt < this->retries ?
+				this->attemptTimeout(write->node, pending->attempt + 1, pending->first) : 0;
+			if(wait == 0) {
+				write->status = UCAN_STATUS_TIMEOUT;
+				this->markUnresponsive(write->node);
+				done = i;
+			} else {
+				this->sendWrite(write);
+				pending->attempt++;
+				pending->wait = wait;
+				pending->sent = millis();
+			}
+		}
+
+		if(done >= 0) {
+			in_flight--;
+			for(uint8_t i = done; i < in_flight; i++)
+				window[i] = window[i + 1];
+		}
+	}
+
+	return succeeded;
+}
+
+// Broadcast methods
+void uCAN_IMPL::configureBroadcasts(BroadcastHandlers *handlers) {
+	this->broadcasts = handlers;
+
+	// broadcast_index[p] is the offset of the first entry for protocol p, so
+	// the entries for p are broadcast_index[p] .. broadcast_index[p + 1] - 1.
+	uint8_t count = 0;
+	for(uint8_t protocol = 0; protocol < UCAN_BROADCAST_PROTOCOLS; protocol++) {
+		this->broadcast_index[protocol] = count;
+		while(handlers && handlers[count].handler != NULL && handlers[count].protocol == protocol)
+			count++;
+	}
+	this->broadcast_index[UCAN_BROADCAST_PROTOCOLS] = count;
+}
+
+BroadcastHandlers *uCAN_IMPL::findBroadcastHandlers(uint8_t protocol, uint16_t subfields) {
+	uint8_t lo = this->broadcast_index[protocol];
+	uint8_t hi = this->broadcast_index[protocol + 1];
+
+	// Binary search over the non-overlapping ranges for this protocol
+	while(lo < hi) {
+		uint8_t mid = (lo + hi) / 2;
+		BroadcastHandlers *handlers = &this->broadcasts[mid];
+		if(subfields < handlers->first)
+			hi = mid;
+		else if(subfields > handlers->last)
+			lo = mid + 1;
+		else
+			return handlers;
+	}
+
+	return NULL;
+}
+
+bool uCAN_IMPL::handleBroadcast(uCANMessage *message) {
+	uint8_t protocol = UCAN_ID_PROTOCOL(message->id);
+	uint16_t subfields = UCAN_ID_BROADCAST_SUBFIELDS(message->id);
+	if(protocol == UCAN_BROADCAST_PROTOCOL_SYSTEM) {
+		if(subfields == UCAN_SYSTEM_HEARTBEAT && this->heartbeat_monitor && message->len >= 1)
+			this->heartbeat_monitor->heard(UCAN_ID_SENDER(message->id), message->body[0]);
+		else if(subfields == UCAN_SYSTEM_TIME_SYNC && this->clock && message->len >= 1)
+			this->clock->sync(UCAN_ID_SENDER(message->id), message->body[0], this->rx_time);
+		else if(subfields == UCAN_SYSTEM_TIME_FOLLOW_UP && this->clock && message->len >= 5)
+			this->clock->followUp(UCAN_ID_SENDER(message->id), message->body[0],
+			                      (uint32_t)message->body[1] | ((uint32_t)message->body[2] << 8) |
+			                      ((uint32_t)message->body[3] << 16) | ((uint32_t)message->body[4] << 24));
+		return true;
+	}
+	BroadcastHandlers *handlers = this->findBroadcastHandlers(protocol, subfields);
+	if(handlers == NULL)
+		return false;
+
+	handlers->handler(UCAN_ID_SENDER(message->id), protocol, subfields, message->len, message->body);
+	return true;
+}
+
+bool uCAN_IMPL::publish(uint8_t protocol, uint16_t subfields, uint8_t len, uint8_t *data) {
+	return this->publish(UCAN_PRIORITY_NORMAL, protocol, subfields, len, data);
+}
+
+// Returns false if the message couldn't be sent
+bool uCAN_IMPL::publish(uint8_t priority, uint8_t protocol, uint16_t subfields, uint8_t len, uint8_t *data) {
+	return this->send(this->makeBroadcastMessageID(priority, protocol, subfields & UCAN_BROADCAST_SUBFIELDS_MAX), len, data) == CAN_OK;
+}
+
+// Broadcasts a one byte heartbeat every period ms from receive(), carrying
+// status, which is the application's to define. Period 0 stops them. The
+// node must call receive() at least that often, and idle() only wakes for
+// traffic, so a node that sleeps may miss beats.
+void uCAN_IMPL::setHeartbeat(uint16_t period, uint8_t status) {
+	this->heartbeat_period = period;
+	this->heartbeat_status = status;
+	this->heartbeat_sent = millis() - period;
+}
+
+void uCAN_IMPL::setHeartbeatStatus(uint8_t status) {
+	this->heartbeat_status = status;
+}
+
+// Tracks the heartbeats of other nodes in monitor, which receive() keeps up
+// to date. NULL stops tracking.
+void uCAN_IMPL::configureHeartbeatMonitor(uCANHeartbeatMonitor *monitor) {
+	this->heartbeat_monitor = monitor;
+}
+
+// Sends the heartbeat if it is due. Beats stay on the period grid unless a
+// whole period has been missed, so a late one doesn't delay the rest.
+void uCAN_IMPL::sendHeartbeat() {
+	if(this->heartbeat_period == 0 || this->node_id == UCAN_BROADCAST_NODE_ID)
+		return;
+	uint32_t now = millis();
+	uint32_t late = now - this->heartbeat_sent;
+	if(late < this->heartbeat_period)
+		return;
+	this->heartbeat_sent = late < 2 * (uint32_t)this->heartbeat_period ? this->heartbeat_sent + this->heartbeat_period : now;
+	this->publish(UCAN_PRIORITY_LOW, UCAN_BROADCAST_PROTOCOL_SYSTEM, UCAN_SYSTEM_HEARTBEAT, 1, &this->heartbeat_status);
+}
+
+// Makes this node the time master: every period ms, receive() broadcasts a
+// SYNC, waits for it to leave the controller, and follows it with the
+// micros() at which it did. Period 0 stops them. Run one master per bus.
+void uCAN_IMPL::setTimeSync(uint16_t period) {
+	this->time_sync_period = period;
+	this->time_sync_sent = millis() - period;
+}
+
+// Keeps clock synchronised to the time master. On the master itself it
+// follows the master's own micros(). NULL stops it.
+void uCAN_IMPL::configureClock(uCANClock *clock) {
+	this->clock = clock;
+}
+
+// Sends SYNC and FOLLOW_UP if they are due. Only called with the transmit
+// queue empty, so the SYNC gets a buffer at once; waiting for it to go out
+// blocks for about a frame time.
+void uCAN_IMPL::sendTimeSync() {
+	if(this->time_sync_period == 0 || this->node_id == UCAN_BROADCAST_NODE_ID)
+		return;
+	uint32_t now = millis();
+	uint32_t late = now - this->time_sync_sent;
+	if(late < this->time_sync_period)
+		return;
+	this->time_sync_sent = late < 2 * (uint32_t)this->time_sync_period ? this->time_sync_sent + this->time_sync_period : now;
+
+	uint8_t body[5];
+	INT32U sent;
+	body[0] = ++this->time_sync_seq;
+	if(this->can->sendMsgBufTimed(this->makeBroadcastMessageID(UCAN_PRIORITY_HIGH, UCAN_BROADCAST_PROTOCOL_SYSTEM, UCAN_SYSTEM_TIME_SYNC),
+	                              1, 1, body, &sent) != CAN_OK)
+		return;
+	if(this->clock) {
+		this->clock->sync(this->node_id, body[0], sent);
+		this->clock->followUp(this->node_id, body[0], sent);
+	}
+	body[1] = sent;
+	body[2] = sent >> 8;
+	body[3] = sent >> 16;
+	body[4] = sent >> 24;
+	this->publish(UCAN_PRIORITY_HIGH, UCAN_BROADCAST_PROTOCOL_SYSTEM, UCAN_SYSTEM_TIME_FOLLOW_UP, sizeof(body), body);
 }
@@ -19,9 +19,14 @@
   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
   1301  USA
 */
+#ifndef _UCAN_H_
+#define _UCAN_H_
+
 #include "mcp_can.h"
+#include "can_pool.h"
 
 #define UCAN_BROADCAST_NODE_ID 0xFF
+#define UCAN_MAX_NODES 128
 #define UCAN_PRIORITY_EMERGENCY 0
 #define UCAN_PRIORITY_HIGH 1
 #define UCAN_PRIORITY_NORMAL 2
@@ -29,27 +34,98 @@
 #define UCAN_NODE_NOT_FOUND -1
 #define UCAN_PROTOCOL_YARP 0
 #define UCAN_PROTOCOL_RAP 1
+#define UCAN_STATUS_PENDING 0
+#define UCAN_STATUS_OK 1
+#define UCAN_STATUS_TIMEOUT 2
+#define UCAN_STATUS_REJECTED 3
+#define UCAN_RAP_WRITE_WINDOW 4
+#define UCAN_RAP_WRITE_MAX 6
+#define UCAN_RAP_READ_MAX 6
+#ifndef UCAN_TX_QUEUE_DEPTH
+#define UCAN_TX_QUEUE_DEPTH 8
+#endif
+// How long send() waits for room to queue a message before dropping it, in ms
+#ifndef UCAN_SEND_TIMEOUT
+#define UCAN_SEND_TIMEOUT 50
+#endif
+#ifndef UCAN_SUBSCRIPTIONS
+#define UCAN_SUBSCRIPTIONS 8
+#endif
+#define UCAN_RAP_NOTIFY_MAX 6
+#ifndef UCAN_RTT_PEERS
+#define UCAN_RTT_PEERS 16
+#endif
+#define UCAN_DEFAULT_TIMEOUT_FLOOR 4
+#define UCAN_DEFAULT_TIMEOUT 1000
+#define UCAN_DEFAULT_RETRIES 2
+#define UCAN_BROADCAST_PROTOCOLS 16
+#define UCAN_BROADCAST_SUBFIELDS_MAX 0x3FFF
+// Broadcast protocol used by the library itself; not for application handlers
+#define UCAN_BROADCAST_PROTOCOL_SYSTEM 15
+#define UCAN_SYSTEM_HEARTBEAT 0x0000
+#define UCAN_SYSTEM_TIME_SYNC 0x0001
+#define UCAN_SYSTEM_TIME_FOLLOW_UP 0x0002
+
+// A uCAN message ID is a 29-bit extended CAN identifier laid out as:
+//   unicast:   priority:2 broadcast:1(0) protocol:4 subfields:6  recipient:8 sender:8
+//   broadcast: priority:2 broadcast:1(1) protocol:4 subfields:14 sender:8
+// Fields are packed and extracted with explicit shifts and masks so the wire
+// format is the same on every compiler and target.
+typedef uint32_t MessageID;
+
+#define UCAN_ID_SENDER_SHIFT 0
+#define UCAN_ID_SENDER_MASK 0xFFUL
+#define UCAN_ID_RECIPIENT_SHIFT 8
+#define UCAN_ID_RECIPIENT_MASK 0xFFUL
+#define UCAN_ID_UNICAST_SUBFIELDS_SHIFT 16
+#define UCAN_ID_UNICAST_SUBFIELDS_MASK 0x3FUL
+#define UCAN_ID_BROADCAST_SUBFIELDS_SHIFT 8
+#define UCAN_ID_BROADCAST_SUBFIELDS_MASK 0x3FFFUL
+#define UCAN_ID_PROTOCOL_SHIFT 22
+#define UCAN_ID_PROTOCOL_MASK 0x0FUL
+#define UCAN_ID_BROADCAST_SHIFT 26
+#define UCAN_ID_BROADCAST_MASK 0x01UL
+#define UCAN_ID_PRIORITY_SHIFT 27
+#define UCAN_ID_PRIORITY_MASK 0x03UL
+
+// Encode a value into / decode a value from the named field
+#define UCAN_ID_BITS(value, field) (((uint32_t)(value) & UCAN_ID_##field##_MASK) << UCAN_ID_##field##_SHIFT)
+#define UCAN_ID_FIELD(id, field) ((uint32_t)((id) >> UCAN_ID_##field##_SHIFT) & UCAN_ID_##field##_MASK)
+#define UCAN_ID_FIELD_MASK(field) UCAN_ID_BITS(UCAN_ID_##field##_MASK, field)
+
+#define UCAN_ID_SENDER(id) ((uint8_t)UCAN_ID_FIELD(id, SENDER))
+#define UCAN_ID_RECIPIENT(id) ((uint8_t)UCAN_ID_FIELD(id, RECIPIENT))
+#define UCAN_ID_UNICAST_SUBFIELDS(id) ((uint8_t)UCAN_ID_FIELD(id, UNICAST_SUBFIELDS))
+#define UCAN_ID_BROADCAST_SUBFIELDS(id) ((uint16_t)UCAN_ID_FIELD(id, BROADCAST_SUBFIELDS))
+#define UCAN_ID_PROTOCOL(id) ((uint8_t)UCAN_ID_FIELD(id, PROTOCOL))
+#define UCAN_ID_IS_BROADCAST(id) (((id) & UCAN_ID_FIELD_MASK(BROADCAST)) != 0)
+#define UCAN_ID_PRIORITY(id) ((uint8_t)UCAN_ID_FIELD(id, PRIORITY))
+
+#define UCAN_UNICAST_ID(priority, protocol, subfields, recipient, sender) \
+  (UCAN_ID_BITS(priority, PRIORITY) | UCAN_ID_BITS(protocol, PROTOCOL) | \
+   UCAN_ID_BITS(subfields, UNICAST_SUBFIELDS) | UCAN_ID_BITS(recipient, RECIPIENT) | UCAN_ID_BITS(sender, SENDER))
+#define UCAN_BROADCAST_ID(priority, protocol, subfields, sender) \
+  (UCAN_ID_BITS(priority, PRIORITY) | UCAN_ID_BITS(1, BROADCAST) | UCAN_ID_BITS(protocol, PROTOCOL) | \
+   UCAN_ID_BITS(subfields, BROADCAST_SUBFIELDS) | UCAN_ID_BITS(sender, SENDER))
+
+// An ID matches a (mask, value) pattern if the bits selected by mask equal value
+#define UCAN_ID_MATCHES(id, mask, value) (((id) & (mask)) == (value))
 
-typedef union {
-  struct {
-    unsigned int sender : 8;
-    unsigned int recipient : 8;
-    unsigned int subfields : 6;
-    unsigned int protocol : 4;
-    unsigned int broadcast : 1;
-    unsigned int priority : 2;
-  } unicast;
-
-  struct {
-    unsigned int sender : 8;
-    unsigned int subfields : 14;
-    unsigned int protocol : 4;
-    unsigned int broadcast : 1;
-    unsigned int priority : 2;
-  } broadcast;
-
-  uint32_t raw;
-} MessageID;
+// Response patterns the stack waits for. The recipient (and, where known, the
+// sender) are ORed into the value once when our node ID changes.
+#define UCAN_MATCH_UNICAST_MASK \
+  (UCAN_ID_FIELD_MASK(BROADCAST) | UCAN_ID_FIELD_MASK(PROTOCOL) | UCAN_ID_FIELD_MASK(RECIPIENT))
+#define UCAN_MATCH_YARP_PONG_MASK (UCAN_MATCH_UNICAST_MASK | UCAN_ID_BITS(0x38, UNICAST_SUBFIELDS))
+#define UCAN_MATCH_YARP_PONG_VALUE (UCAN_ID_BITS(UCAN_PROTOCOL_YARP, PROTOCOL) | UCAN_ID_BITS(0x38, UNICAST_SUBFIELDS))
+// A node's address: a pong from the node itself, or an assignment from an address server
+#define UCAN_MATCH_YARP_ADDRESS_MASK (UCAN_MATCH_UNICAST_MASK | UCAN_ID_BITS(0x18, UNICAST_SUBFIELDS))
+#define UCAN_MATCH_YARP_ADDRESS_VALUE (UCAN_ID_BITS(UCAN_PROTOCOL_YARP, PROTOCOL) | UCAN_ID_BITS(0x18, UNICAST_SUBFIELDS))
+#define UCAN_MATCH_RAP_READ_RESPONSE_MASK (UCAN_MATCH_UNICAST_MASK | UCAN_ID_BITS(0x38, UNICAST_SUBFIELDS))
+#define UCAN_MATCH_RAP_READ_RESPONSE_VALUE (UCAN_ID_BITS(UCAN_PROTOCOL_RAP, PROTOCOL) | UCAN_ID_BITS(0x10, UNICAST_SUBFIELDS))
+#define UCAN_MATCH_RAP_NOTIFY_MASK (UCAN_MATCH_UNICAST_MASK | UCAN_ID_BITS(0x38, UNICAST_SUBFIELDS))
+#define UCAN_MATCH_RAP_NOTIFY_VALUE (UCAN_ID_BITS(UCAN_PROTOCOL_RAP, PROTOCOL) | UCAN_ID_BITS(0x18, UNICAST_SUBFIELDS))
+#define UCAN_MATCH_RAP_WRITE_ACK_MASK (UCAN_MATCH_UNICAST_MASK | UCAN_ID_BITS(0x30, UNICAST_SUBFIELDS))
+#define UCAN_MATCH_RAP_WRITE_ACK_VALUE (UCAN_ID_BITS(UCAN_PROTOCOL_RAP, PROTOCOL) | UCAN_ID_BITS(0x30, UNICAST_SUBFIELDS))
 
 typedef struct {
   uint8_t address[6];
@@ -63,6 +139,19 @@ typedef struct {
 
 typedef int16_t NodeAddress;
 
+// Round trip estimate for one peer, in us, kept as in RFC 6298. The table is
+// direct mapped by node ID, so with fewer than UCAN_MAX_NODES slots peers that
+// share a slot evict each other.
+typedef struct {
+  uint8_t node;
+  uint16_t srtt;
+  uint16_t rttvar;
+} RTTEstimate;
+
+class uCANAddressServer;
+class uCANHeartbeatMonitor;
+class uCANClock;
+
 typedef void (*PongHandler)(HardwareID hardware_id, uint8_t node_id);
 typedef void (*AddressChangeHandler)(uint8_t node_id);
 
@@ -75,30 +164,118 @@ typedef struct {
   RegisterWriteHandler write;
 } RegisterHandlers;
 
+// One acknowledged register write; status is set to one of UCAN_STATUS_*
+typedef struct {
+  NodeAddress node;
+  uint8_t page;
+  uint8_t reg;
+  uint8_t len;
+  uint8_t *data;
+  uint8_t status;
+} RegisterWrite;
+
+// A peer's subscription to registers reg..reg+len-1 of page. Changes are sent
+// to it at most once every interval ms, with the values current at the time.
+typedef struct {
+  uint8_t node;                     // UCAN_BROADCAST_NODE_ID if the slot is free
+  uint8_t priority;
+  uint8_t page;
+  uint8_t reg;
+  uint8_t len;
+  bool changed;
+  uint16_t interval;
+  uint32_t sent;                    // millis() at the last notification
+} Subscription;
+
+typedef void (*NotificationHandler)(uint8_t sender, uint8_t page, uint8_t reg, uint8_t len, uint8_t *data);
+
+typedef void (*BroadcastHandler)(uint8_t sender, uint8_t protocol, uint16_t subfields, uint8_t len, uint8_t *data);
+
+// Subscription to the broadcast subfields first..last (inclusive) of one
+// protocol. Tables passed to configureBroadcasts must be sorted by protocol,
+// then by first, with non-overlapping ranges, and terminated by a NULL handler.
+// UCAN_BROADCAST_PROTOCOL_SYSTEM is handled by the library.
+typedef struct {
+  uint8_t protocol;
+  uint16_t first;
+  uint16_t last;
+  BroadcastHandler handler;
+} BroadcastHandlers;
+
 class uCAN_IMPL {
 private:
+    MCP_CAN *can;
+    CANFramePool *pool;
     uint8_t node_id;
     HardwareID hardware_id;
     AddressChangeHandler address_change_handler;
+    uCANAddressServer *address_server;
+    uCANHeartbeatMonitor *heartbeat_monitor;
+    uint16_t heartbeat_period;
+    uint8_t heartbeat_status;
+    uint32_t heartbeat_sent;
+    uCANClock *clock;
+    uint16_t time_sync_period;
+    uint8_t time_sync_seq;
+    uint32_t time_sync_sent;
+    uint32_t rx_time;                 // micros() as the message being handled was read
     RegisterHandlers *registers;
+    Subscription subscriptions[UCAN_SUBSCRIPTIONS];
+    NotificationHandler notification_handler;
+    BroadcastHandlers *broadcasts;
+    uint8_t broadcast_index[UCAN_BROADCAST_PROTOCOLS + 1];
     uint16_t timeout;
+    uint16_t timeout_floor;
+    uint8_t retries;
+    RTTEstimate rtt[UCAN_RTT_PEERS];
+    CANFrameQueue tx_queue;
+    MessageID pong_match;
+    MessageID address_match;
+    MessageID read_response_match;
+    MessageID write_ack_match;
+    MessageID notify_match;
 
     bool tryReceive(uCANMessage *message);
+    bool flushTransmitQueue();
+    bool waitForTraffic(uint32_t timeout);
+    bool pollMessage(MessageID mask, MessageID value, uCANMessage *message);
+    bool waitForMessage(MessageID mask, MessageID value, uCANMessage *message, uint32_t start, uint16_t timeout);
+    bool request(NodeAddress node, MessageID id, uint8_t len, uint8_t *body, MessageID mask, MessageID value,
+                 const uint8_t *match, uint8_t match_len, uCANMessage *message);
+    void sampleRTT(uint8_t node, uint32_t rtt);
+    void backoffRTT(uint8_t node, uint32_t since_first);
+    void markUnresponsive(NodeAddress node);
+    uint16_t attemptTimeout(NodeAddress node, uint8_t attempt, uint32_t first);
+    bool sendWrite(RegisterWrite *write);
+    void subscribe(uint8_t sender, uint8_t priority, uint8_t page, uint8_t reg, uint8_t len, uint16_t interval);
+    void sendNotification(Subscription *subscription);
+    bool sendNotifications();
+    void sendHeartbeat();
+    void sendTimeSync();
     RegisterHandlers *findRegisterHandlers(uint8_t page);
+    BroadcastHandlers *findBroadcastHandlers(uint8_t protocol, uint16_t subfields);
+    void setNodeID(uint8_t node_id);
+    uint8_t configureFilters();
 
 protected:
     MessageID makeUnicastMessageID(uint8_t priority, uint8_t protocol, uint8_t subfields, uint8_t recipient);
     MessageID makeBroadcastMessageID(uint8_t priority, uint8_t protocol, uint16_t subfields);
     bool handleYARP(uCANMessage *message);
     bool handleRAP(uCANMessage *message);
-    void send(MessageID id, uint8_t len, uint8_t *message);
+    bool handleBroadcast(uCANMessage *message);
+    uint8_t send(MessageID id, uint8_t len, uint8_t *message);
 
 public:
-    uCAN_IMPL();
+    uCAN_IMPL(MCP_CAN *can = &CAN, CANFramePool *pool = &CANPool);
     uint8_t begin(HardwareID hardware_id, uint8_t node_id);
     uint8_t begin(HardwareID hardware_id);
     bool receive();
+    uint8_t service(uint8_t max_frames, uint16_t max_ms);
+    bool idle();
+    uint8_t getNodeID();
     void setTimeout(uint16_t timeout);
+    void setTimeout(uint16_t floor, uint16_t ceiling, uint8_t retries);
+    uint16_t getTimeout(NodeAddress node);
 
     // YARP methods
     NodeAddress getNodeFromNodeID(uint8_t node_id);
@@ -106,11 +283,35 @@ public:
     bool ping(NodeAddress node);
     bool ping(NodeAddress node, HardwareID *hardware_id);
     void registerAddressChangeHandler(AddressChangeHandler handler);
-    void setAddress(HardwareID hardware_id, uint8_t node_id);
+    bool setAddress(HardwareID hardware_id, uint8_t node_id);
+    void configureAddressServer(uCANAddressServer *server);
 
     // RAP methods
     void configureRegisters(RegisterHandlers *handlers);
     bool readRegisters(NodeAddress node, uint8_t page, uint8_t reg, uint8_t len, uint8_t *data);
-    void writeRegisters(NodeAddress node, uint8_t page, uint8_t reg, uint8_t len, uint8_t *data);
+    bool writeRegisters(NodeAddress node, uint8_t page, uint8_t reg, uint8_t len, uint8_t *data);
+    uint8_t writeRegisters(RegisterWrite *writes, uint8_t count);
+    uint8_t pollRegisters(NodeAddress *nodes, uint8_t count, uint8_t page, uint8_t reg, uint8_t len, uint8_t *results, uint8_t *status);
+    uint8_t pollRegisters(uint8_t page, uint8_t reg, uint8_t len, uint8_t *results, uint8_t *replied);
+    bool subscribeRegisters(NodeAddress node, uint8_t page, uint8_t reg, uint8_t len, uint16_t interval, uint8_t *data);
+    bool unsubscribeRegisters(NodeAddress node, uint8_t page, uint8_t reg);
+    void registerNotificationHandler(NotificationHandler handler);
+    void notifyRegisterChanged(uint8_t page, uint8_t reg, uint8_t len);
+
+    // Broadcast methods
+    void configureBroadcasts(BroadcastHandlers *handlers);
+    bool publish(uint8_t protocol, uint16_t subfields, uint8_t len, uint8_t *data);
+    bool publish(uint8_t priority, uint8_t protocol, uint16_t subfields, uint8_t len, uint8_t *data);
+
+    // Heartbeat methods
+    void setHeartbeat(uint16_t period, uint8_t status);
+    void setHeartbeatStatus(uint8_t status);
+    void configureHeartbeatMonitor(uCANHeartbeatMonitor *monitor);
+
+    // Time sync methods
+    void setTimeSync(uint16_t period);
+    void configureClock(uCANClock *clock);
 };
 extern uCAN_IMPL uCAN;
+
+#endif
@@ -0,0 +1,183 @@
+#include <Arduino.h>
+#ifdef __linux__
+#include <stdio.h>
+#else
+#include <EEPROM.h>
+#endif
+#include "ucan_address.h"
+
+#define UCAN_ADDRESS_BITMAP_OFFSET 2
+#define UCAN_ADDRESS_IDS_OFFSET (UCAN_ADDRESS_BITMAP_OFFSET + UCAN_MAX_NODES / 8)
+
+#ifdef __linux__
+uCANAddressServer::uCANAddressServer(const char *path) {
+	this->path = path;
+	this->count = 0;
+	memset(this->allocated, 0, sizeof(this->allocated));
+}
+#else
+uCANAddressServer::uCANAddressServer(uint16_t eeprom_offset) {
+	this->eeprom_offset = eeprom_offset;
+	this->count = 0;
+	memset(this->allocated, 0, sizeof(this->allocated));
+}
+#endif
+
+// Reads the stored table. A missing or foreign one leaves the table empty.
+void uCANAddressServer::load() {
+	uint16_t magic = 0;
+
+	memset(this->allocated, 0, sizeof(this->allocated));
+	this->count = 0;
+#ifdef __linux__
+	FILE *file = fopen(this->path, "rb");
+	if(file == NULL)
+		return;
+	bool ok = fread(&magic, sizeof(magic), 1, file) == 1 && magic == UCAN_ADDRESS_MAGIC &&
+	          fread(this->allocated, sizeof(this->allocated), 1, file) == 1 &&
+	          fread(this->hardware_ids, sizeof(this->hardware_ids), 1, file) == 1;
+	fclose(file);
+	if(!ok) {
+		memset(this->allocated, 0, sizeof(this->allocated));
+		return;
+	}
+#else
+	EEPROM.get(this->eeprom_offset, magic);
+	if(magic != UCAN_ADDRESS_MAGIC)
+		return;
+	EEPROM.get(this->eeprom_offset + UCAN_ADDRESS_BITMAP_OFFSET, this->allocated);
+	EEPROM.get(this->eeprom_offset + UCAN_ADDRESS_IDS_OFFSET, this->hardware_ids);
+#endif
+
+	// Rebuild the index
+	uint8_t allocated[UCAN_MAX_NODES / 8];
+	memcpy(allocated, this->allocated, sizeof(allocated));
+	memset(this->allocated, 0, sizeof(this->allocated));
+	for(uint8_t node_id = 0; node_id < UCAN_MAX_NODES; node_id++) {
+		if(allocated[node_id / 8] & (1 << (node_id % 8)))
+			this->insert(node_id, &this->hardware_ids[node_id]);
+	}
+}
+
+// Forgets every allocation, in storage too
+void uCANAddressServer::clear() {
+	memset(this->allocated, 0, sizeof(this->allocated));
+	this->count = 0;
+	for(uint8_t node_id = 0; node_id < UCAN_MAX_NODES; node_id += 8)
+		this->save(node_id);
+}
+
+// Binary search of the index. Returns where hardware_id is, or would go.
+uint8_t uCANAddressServer::position(const HardwareID *hardware_id, bool *found) {
+	uint8_t lo = 0, hi = this->count;
+	*found = false;
+	while(lo < hi) {
+		uint8_t mid = (lo + hi) / 2;
+		int cmp = memcmp(hardware_id, &this->hardware_ids[this->index[mid]], sizeof(HardwareID));
+		if(cmp < 0) {
+			hi = mid;
+		} else if(cmp > 0) {
+			lo = mid + 1;
+		} else {
+			*found = true;
+			return mid;
+		}
+	}
+	return lo;
+}
+
+// Marks node_id allocated to hardware_id, which must not be in the index
+void uCANAddressServer::insert(uint8_t node_id, const HardwareID *hardware_id) {
+	bool found;
+	uint8_t pos = this->position(hardware_id, &found);
+	memmove(&this->index[pos + 1], &this->index[pos], this->count - pos);
+	this->index[pos] = node_id;
+	this->count++;
+	this->hardware_ids[node_id] = *hardware_id;
+	this->allocated[node_id / 8] |= 1 << (node_id % 8);
+}
+
+void uCANAddressServer::remove(uint8_t node_id) {
+	if(!this->isAllocated(node_id))
+		return;
+	bool found;
+	uint8_t pos = this->position(&this->hardware_ids[node_id], &found);
+	this->count--;
+	memmove(&this->index[pos], &this->index[pos + 1], this->count - pos);
+	this->allocated[node_id / 8] &= ~(1 << (node_id % 8));
+}
+
+// Writes through the entry for node_id and its byte of the bitmap. EEPROM
+// cells that already hold the right value aren't rewritten.
+void uCANAddressServer::save(uint8_t node_id) {
+#ifdef __linux__
+	(void)node_id;
+	uint16_t magic = UCAN_ADDRESS_MAGIC;
+	FILE *file = fopen(this->path, "wb");
+	if(file == NULL)
+		return;
+	fwrite(&magic, sizeof(magic), 1, file);
+	fwrite(this->allocated, sizeof(this->allocated), 1, file);
+	fwrite(this->hardware_ids, sizeof(this->hardware_ids), 1, file);
+	fclose(file);
+#else
+	EEPROM.put(this->eeprom_offset, (uint16_t)UCAN_ADDRESS_MAGIC);
+	EEPROM.update(this->eeprom_offset + UCAN_ADDRESS_BITMAP_OFFSET + node_id / 8, this->allocated[node_id / 8]);
+	if(this->isAllocated(node_id))
+		EEPROM.put(this->eeprom_offset + UCAN_ADDRESS_IDS_OFFSET + node_id * sizeof(HardwareID), this->hardware_ids[node_id]);
+#endif
+}
+
+NodeAddress uCANAddressServer::lookup(HardwareID hardware_id) {
+	bool found;
+	uint8_t pos = this->position(&hardware_id, &found);
+	return found ? this->index[pos] : UCAN_NODE_NOT_FOUND;
+}
+
+// The node ID for hardware_id, allocating one if it has none. New hardware
+// gets the first free ID from the one begin() would probe first, so nodes
+// keep the IDs they would have picked for themselves where they can.
+NodeAddress uCANAddressServer::allocate(HardwareID hardware_id) {
+	NodeAddress node = this->lookup(hardware_id);
+	if(node != UCAN_NODE_NOT_FOUND || this->count == UCAN_MAX_NODES)
+		return node;
+
+	uint8_t node_id = hardware_id.address[5] & 0x7F;
+	while(this->isAllocated(node_id))
+		node_id = (node_id + 1) & 0x7F;
+	this->insert(node_id, &hardware_id);
+	this->save(node_id);
+	return node_id;
+}
+
+// Records that hardware_id has node_id, e.g. for nodes configured by hand or
+// the server itself. Whatever either had before is released.
+void uCANAddressServer::assign(HardwareID hardware_id, uint8_t node_id) {
+	node_id &= 0x7F;
+	NodeAddress previous = this->lookup(hardware_id);
+	if(previous == node_id)
+		return;
+	if(previous != UCAN_NODE_NOT_FOUND) {
+		this->remove(previous);
+		this->save(previous);
+	}
+	this->remove(node_id);
+	this->insert(node_id, &hardware_id);
+	this->save(node_id);
+}
+
+void uCANAddressServer::release(uint8_t node_id) {
+	node_id &= 0x7F;
+	if(!this->isAllocated(node_id))
+		return;
+	this->remove(node_id);
+	this->save(node_id);
+}
+
+bool uCANAddressServer::isAllocated(uint8_t node_id) {
+	return node_id < UCAN_MAX_NODES && (this->allocated[node_id / 8] & (1 << (node_id % 8)));
+}
+
+uint8_t uCANAddressServer::getCount() {
+	return this->count;
+}
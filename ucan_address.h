@@ -0,0 +1,68 @@
+/*
+  ucan_address.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _UCAN_ADDRESS_H_
+#define _UCAN_ADDRESS_H_
+
+#include "uCAN.h"
+
+// Stored table layout: magic, allocation bitmap, then the hardware ID of
+// every node ID, 786 bytes in all.
+#define UCAN_ADDRESS_MAGIC 0x4155
+#define UCAN_ADDRESS_STORE_SIZE (2 + UCAN_MAX_NODES / 8 + UCAN_MAX_NODES * sizeof(HardwareID))
+
+// Node ID allocation table for an address server. Nodes starting up look
+// themselves up by hardware ID; the server answers with the ID they had
+// before or, for new hardware, the lowest free ID from the one they would
+// pick themselves. Every change is written through to EEPROM, or to a file
+// when running on Linux, so a restarted server hands out the same IDs.
+class uCANAddressServer {
+private:
+    uint8_t allocated[UCAN_MAX_NODES / 8];
+    HardwareID hardware_ids[UCAN_MAX_NODES];
+    uint8_t index[UCAN_MAX_NODES];  // allocated node IDs, sorted by hardware ID
+    uint8_t count;
+#ifdef __linux__
+    const char *path;
+#else
+    uint16_t eeprom_offset;
+#endif
+
+    uint8_t position(const HardwareID *hardware_id, bool *found);
+    void insert(uint8_t node_id, const HardwareID *hardware_id);
+    void remove(uint8_t node_id);
+    void save(uint8_t node_id);
+
+public:
+#ifdef __linux__
+    uCANAddressServer(const char *path);
+#else
+    uCANAddressServer(uint16_t eeprom_offset = 0);
+#endif
+    void load();
+    void clear();
+    NodeAddress lookup(HardwareID hardware_id);
+    NodeAddress allocate(HardwareID hardware_id);
+    void assign(HardwareID hardware_id, uint8_t node_id);
+    void release(uint8_t node_id);
+    bool isAllocated(uint8_t node_id);
+    uint8_t getCount();
+};
+
+#endif
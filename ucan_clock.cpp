@@ -0,0 +1,125 @@
+#include <Arduino.h>
+#include "ucan_clock.h"
+
+// Largest believable rate difference: 1%, * 2^32
+#define UCAN_CLOCK_MAX_DRIFT 42949673L
+
+uCANClock::uCANClock() {
+	this->reset();
+}
+
+// Forgets the master and everything learned from it
+void uCANClock::reset() {
+	this->master = UCAN_BROADCAST_NODE_ID;
+	this->samples = 0;
+	this->outliers = 0;
+	this->sync_pending = false;
+	this->base_local = 0;
+	this->base_master = 0;
+	this->drift = 0;
+	this->synced = 0;
+}
+
+// Jumps to the master's time, keeping the drift estimate
+void uCANClock::step(uint32_t local, uint32_t master_time) {
+	this->base_local = local;
+	this->base_master = master_time;
+	this->samples = 1;
+	this->outliers = 0;
+	this->synced = millis();
+}
+
+// A SYNC from sender, which arrived when our micros() read local
+void uCANClock::sync(uint8_t sender, uint8_t seq, uint32_t local) {
+	if(sender != this->master) {
+		// Stay with a lower numbered master unless it has gone quiet
+		if(this->master < sender && this->samples > 0 &&
+		   (uint32_t)(millis() - this->synced) < UCAN_CLOCK_TIMEOUT)
+			return;
+		this->reset();
+		this->master = sender;
+	}
+	this->sync_pending = true;
+	this->sync_seq = seq;
+	this->sync_local = local;
+}
+
+// The FOLLOW_UP to the SYNC with sequence number seq: the master's micros()
+// when that SYNC went out
+void uCANClock::followUp(uint8_t sender, uint8_t seq, uint32_t master_time) {
+	if(!this->sync_pending || sender != this->master || seq != this->sync_seq)
+		return;
+	this->sync_pending = false;
+
+	uint32_t local = this->sync_local;
+	if(this->samples == 0) {
+		this->step(local, master_time);
+		return;
+	}
+	uint32_t interval = local - this->base_local;
+	if((int32_t)interval <= 0)
+		return;
+	int32_t error = (int32_t)(master_time - this->toSynchronised(local));
+
+	int64_t drift = this->drift;
+	if(this->samples == 1) {
+		// First rate measurement: take all of it, however large
+		drift += (int64_t)error * 4294967296LL / interval;
+		this->base_master = master_time;
+	} else {
+		if(error > UCAN_CLOCK_MAX_ERROR || error < -UCAN_CLOCK_MAX_ERROR) {
+			if(++this->outliers >= UCAN_CLOCK_MAX_OUTLIERS)
+				this->step(local, master_time);
+			return;
+		}
+		// Correct half the phase error now, and a quarter of the rate error
+		// it implies, which settles in a few syncs without overshoot
+		drift += (int64_t)error * 4294967296LL / interval / 4;
+		this->base_master = this->toSynchronised(local) + error / 2;
+	}
+	if(drift > UCAN_CLOCK_MAX_DRIFT)
+		drift = UCAN_CLOCK_MAX_DRIFT;
+	else if(drift < -UCAN_CLOCK_MAX_DRIFT)
+		drift = -UCAN_CLOCK_MAX_DRIFT;
+	this->drift = drift;
+	this->base_local = local;
+	this->outliers = 0;
+	if(this->samples < 255)
+		this->samples++;
+	this->synced = millis();
+}
+
+// True once both offset and rate have been measured, until the master has
+// been silent for UCAN_CLOCK_TIMEOUT ms
+bool uCANClock::isSynchronised() {
+	return this->samples >= 2 && (uint32_t)(millis() - this->synced) < UCAN_CLOCK_TIMEOUT;
+}
+
+// The master's micros(), as far as we can tell. Before the first sync this
+// is our own.
+uint32_t uCANClock::micros() {
+	return this->toSynchronised(::micros());
+}
+
+// Converts a timestamp taken with our micros() to the master's clock. Works
+// for times up to 35 minutes either side of the last sync.
+uint32_t uCANClock::toSynchronised(uint32_t local) {
+	int32_t elapsed = (int32_t)(local - this->base_local);
+	return this->base_master + elapsed + (int32_t)(((int64_t)elapsed * this->drift) >> 32);
+}
+
+// Master's time minus ours, in us
+int32_t uCANClock::getOffset() {
+	uint32_t now = ::micros();
+	return (int32_t)(this->toSynchronised(now) - now);
+}
+
+// How much faster the master's clock runs than ours, in parts per billion
+int32_t uCANClock::getDrift() {
+	return (int32_t)(((int64_t)this->drift * 1000000000LL) >> 32);
+}
+
+// The node we follow, or UCAN_BROADCAST_NODE_ID
+uint8_t uCANClock::getMaster() {
+	return this->master;
+}
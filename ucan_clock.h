@@ -0,0 +1,80 @@
+/*
+  ucan_clock.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _UCAN_CLOCK_H_
+#define _UCAN_CLOCK_H_
+
+#include "uCAN.h"
+
+// Without a sync for this long, in ms, the clock counts as unsynchronised
+// and follows whichever master it hears next
+#ifndef UCAN_CLOCK_TIMEOUT
+#define UCAN_CLOCK_TIMEOUT 5000
+#endif
+// Samples further than this from the estimate, in us, are ignored as late
+// receptions, unless UCAN_CLOCK_MAX_OUTLIERS of them arrive in a row, when
+// the clock steps to the master's time
+#ifndef UCAN_CLOCK_MAX_ERROR
+#define UCAN_CLOCK_MAX_ERROR 1000
+#endif
+#define UCAN_CLOCK_MAX_OUTLIERS 3
+
+// A microsecond clock that follows the time master's micros(), from the SYNC
+// and FOLLOW_UP broadcasts it sends with uCAN.setTimeSync(). Each SYNC is
+// timestamped with our micros() when it is read; the FOLLOW_UP carries the
+// master's micros() when the SYNC finished transmitting. The difference is
+// one sample of the offset between the clocks. Offset and drift are then
+// tracked with a simple phase-locked loop, so between syncs the clock runs at
+// the master's rate rather than ours.
+//
+// Samples are only as good as the receive timestamps, taken when receive()
+// reads the SYNC, so a node that services the bus late sees the master's
+// clock as behind. Samples far off the estimate are dropped.
+//
+// If there are several masters, the one with the lowest node ID is followed.
+// Attach to a node with uCAN.configureClock(), which feeds it from receive().
+class uCANClock {
+private:
+    uint8_t master;                 // node we follow, or UCAN_BROADCAST_NODE_ID
+    uint8_t samples;
+    uint8_t outliers;
+    bool sync_pending;
+    uint8_t sync_seq;
+    uint32_t sync_local;            // our micros() when the pending SYNC arrived
+    uint32_t base_local;            // our micros() at the last sample...
+    uint32_t base_master;           // ...and the master's time then
+    int32_t drift;                  // master's rate relative to ours, minus 1, * 2^32
+    uint32_t synced;                // millis() at the last sample
+
+    void step(uint32_t local, uint32_t master_time);
+
+public:
+    uCANClock();
+    void reset();
+    void sync(uint8_t sender, uint8_t seq, uint32_t local);
+    void followUp(uint8_t sender, uint8_t seq, uint32_t master_time);
+    bool isSynchronised();
+    uint32_t micros();
+    uint32_t toSynchronised(uint32_t local);
+    int32_t getOffset();
+    int32_t getDrift();
+    uint8_t getMaster();
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include <Arduino.h>
+#include "ucan_heartbeat.h"
+
+uCANHeartbeatMonitor::uCANHeartbeatMonitor(uint16_t timeout, HeartbeatHandler handler) {
+	memset(this->alive, 0, sizeof(this->alive));
+	this->count = 0;
+	this->timeout = timeout;
+	this->checked = 0;
+	this->handler = handler;
+}
+
+// Records a heartbeat from node_id
+void uCANHeartbeatMonitor::heard(uint8_t node_id, uint8_t status) {
+	if(node_id >= UCAN_MAX_NODES)
+		return;
+	this->last_seen[node_id] = millis();
+	this->status[node_id] = status;
+	if(!this->isAlive(node_id)) {
+		this->alive[node_id / 8] |= 1 << (node_id % 8);
+		this->count++;
+		if(this->handler)
+			this->handler(node_id, true, status);
+	}
+}
+
+// Marks nodes whose heartbeats have stopped as dead. Cheap enough to call on
+// every pass of the main loop: it does nothing until millis() moves on, and
+// skips whole bytes of the bitmap with no live nodes.
+void uCANHeartbeatMonitor::check() {
+	uint32_t now = millis();
+	if(now == this->checked || this->count == 0)
+		return;
+	this->checked = now;
+
+	for(uint8_t i = 0; i < UCAN_MAX_NODES / 8; i++) {
+		if(this->alive[i] == 0)
+			continue;
+		for(uint8_t bit = 0; bit < 8; bit++) {
+			uint8_t node_id = i * 8 + bit;
+			if((this->alive[i] & (1 << bit)) && (uint32_t)(now - this->last_seen[node_id]) >= this->timeout) {
+				this->alive[i] &= ~(1 << bit);
+				this->count--;
+				if(this->handler)
+					this->handler(node_id, false, this->status[node_id]);
+			}
+		}
+	}
+}
+
+bool uCANHeartbeatMonitor::isAlive(uint8_t node_id) {
+	return node_id < UCAN_MAX_NODES && (this->alive[node_id / 8] & (1 << (node_id % 8)));
+}
+
+// millis() at node_id's last heartbeat; only meaningful once it has sent one
+uint32_t uCANHeartbeatMonitor::getLastSeen(uint8_t node_id) {
+	return this->last_seen[node_id & 0x7F];
+}
+
+// Status byte of node_id's last heartbeat
+uint8_t uCANHeartbeatMonitor::getStatus(uint8_t node_id) {
+	return this->status[node_id & 0x7F];
+}
+
+uint8_t uCANHeartbeatMonitor::getAliveCount() {
+	return this->count;
+}
+
+// UCAN_MAX_NODES-bit bitmap, bit n set if node n is alive
+const uint8_t *uCANHeartbeatMonitor::getAlive() {
+	return this->alive;
+}
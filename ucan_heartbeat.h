@@ -0,0 +1,54 @@
+/*
+  ucan_heartbeat.h
+  2026 Copyright (c) Arachnid Labs Ltd.  All right reserved.
+
+  This library is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License, or (at your option) any later version.
+
+  This library is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with this library; if not, write to the Free Software
+  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-
+  1301  USA
+*/
+#ifndef _UCAN_HEARTBEAT_H_
+#define _UCAN_HEARTBEAT_H_
+
+#include "uCAN.h"
+
+// Called when a node's first heartbeat arrives and when its heartbeats stop
+typedef void (*HeartbeatHandler)(uint8_t node_id, bool alive, uint8_t status);
+
+// Liveness of every node, from the heartbeats they broadcast with
+// uCAN.setHeartbeat(). A node is alive from its first heartbeat until none
+// has arrived for timeout ms; pick a timeout of two or three heartbeat
+// periods so a single lost frame doesn't count. Attach to a node with
+// uCAN.configureHeartbeatMonitor(), which feeds it from receive().
+class uCANHeartbeatMonitor {
+private:
+    uint8_t alive[UCAN_MAX_NODES / 8];
+    uint32_t last_seen[UCAN_MAX_NODES];  // millis()
+    uint8_t status[UCAN_MAX_NODES];
+    uint8_t count;
+    uint16_t timeout;
+    uint32_t checked;
+    HeartbeatHandler handler;
+
+public:
+    uCANHeartbeatMonitor(uint16_t timeout, HeartbeatHandler handler = NULL);
+    void heard(uint8_t node_id, uint8_t status);
+    void check();
+    bool isAlive(uint8_t node_id);
+    uint32_t getLastSeen(uint8_t node_id);
+    uint8_t getStatus(uint8_t node_id);
+    uint8_t getAliveCount();
+    const uint8_t *getAlive();
+};
+
+#endif